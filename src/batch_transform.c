@@ -0,0 +1,537 @@
+// Native batch transformer for server-side prerendering.
+//
+// Compiles one stylesheet, then transforms many source files with it on a
+// work-stealing thread pool. The compiled stylesheet is shared read-only by
+// all threads, and each job gets its own transformation context (see
+// xslt_polyfill_apply_stylesheet() in transform.c). Requires libxml2 and
+// libxslt built with thread support; see the `batch` target in the Makefile.
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include <libxslt/transform.h>
+#include <libxslt/xsltInternals.h>
+#include <libxslt/xsltutils.h>
+
+#include "transform.h"
+
+#define MAX_PARAMS 64
+
+// A per-thread double-ended job queue. The owning thread pops from the tail,
+// and idle threads steal from the head.
+typedef struct {
+  pthread_mutex_t lock;
+  int *jobs;
+  int head;
+  int tail;
+} WorkQueue;
+
+typedef struct {
+  xsltStylesheetPtr sheet;
+  const char **params;
+  char **inputs;
+  int num_inputs;
+  const char *out_dir;
+  WorkQueue *queues;
+  int num_threads;
+  atomic_int succeeded;
+  atomic_int failed;
+} BatchState;
+
+typedef struct {
+  BatchState *state;
+  int index;
+} Worker;
+
+static int queue_pop(WorkQueue *queue, int *job) {
+  int found = 0;
+  pthread_mutex_lock(&queue->lock);
+  if (queue->tail > queue->head) {
+    *job = queue->jobs[--queue->tail];
+    found = 1;
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return found;
+}
+
+static int queue_steal(WorkQueue *queue, int *job) {
+  int found = 0;
+  pthread_mutex_lock(&queue->lock);
+  if (queue->tail > queue->head) {
+    *job = queue->jobs[queue->head++];
+    found = 1;
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return found;
+}
+
+// Returns the next job for a worker, stealing from the other queues once its
+// own queue is empty. No jobs are added after startup, so once every queue is
+// empty the batch is done.
+static int next_job(Worker *worker, int *job) {
+  BatchState *state = worker->state;
+  int i;
+
+  if (queue_pop(&state->queues[worker->index], job))
+    return 1;
+  for (i = 1; i < state->num_threads; i++) {
+    int victim = (worker->index + i) % state->num_threads;
+    if (queue_steal(&state->queues[victim], job))
+      return 1;
+  }
+  return 0;
+}
+
+static const char *extension_for_mime_type(const char *mime_type) {
+  if (strcmp(mime_type, "text/html") == 0)
+    return ".html";
+  if (strcmp(mime_type, "text/plain") == 0)
+    return ".txt";
+  return ".xml";
+}
+
+// Returns an input file's path relative to the output directory, without its
+// extension. Leading slashes, "." segments and repeated slashes are dropped, so
+// that inputs naming the same output file get the same stem. Returns NULL for
+// inputs that would escape the output directory.
+static char *output_stem(const char *input) {
+  char *stem = malloc(strlen(input) + 1);
+  size_t len = 0;
+  char *base;
+  char *dot;
+
+  if (stem == NULL)
+    return NULL;
+  while (*input != '\0') {
+    const char *end = strchr(input, '/');
+    size_t seg_len = end ? (size_t)(end - input) : strlen(input);
+    if (seg_len == 2 && strncmp(input, "..", 2) == 0) {
+      free(stem);
+      return NULL;
+    }
+    if (seg_len > 0 && !(seg_len == 1 && input[0] == '.')) {
+      if (len > 0)
+        stem[len++] = '/';
+      memcpy(stem + len, input, seg_len);
+      len += seg_len;
+    }
+    input += seg_len;
+    if (*input == '/')
+      input++;
+  }
+  stem[len] = '\0';
+  if (len == 0) {
+    free(stem);
+    return NULL;
+  }
+
+  base = strrchr(stem, '/');
+  base = base ? base + 1 : stem;
+  dot = strrchr(base, '.');
+  if (dot && dot != base)
+    *dot = '\0';
+  return stem;
+}
+
+// Builds the output path for an input file by mirroring its relative path
+// under `out_dir` and replacing its extension to match the output MIME type.
+// Returns NULL for inputs that would escape `out_dir`.
+static char *output_path(const char *out_dir, const char *input,
+                         const char *mime_type) {
+  const char *ext = extension_for_mime_type(mime_type);
+  char *stem = output_stem(input);
+  size_t len;
+  char *path;
+
+  if (stem == NULL)
+    return NULL;
+  len = strlen(out_dir) + 1 + strlen(stem) + strlen(ext) + 1;
+  path = malloc(len);
+  if (path != NULL)
+    snprintf(path, len, "%s/%s%s", out_dir, stem, ext);
+  free(stem);
+  return path;
+}
+
+typedef struct {
+  char *stem;
+  const char *input;
+} OutputName;
+
+static int compare_output_names(const void *a, const void *b) {
+  return strcmp(((const OutputName *)a)->stem, ((const OutputName *)b)->stem);
+}
+
+// Checks that every input maps to a valid output path, and that no two inputs
+// map to the same one (such as a.xml and a.xhtml), since their results would
+// be written to the same file concurrently. Returns 0 if all paths are usable.
+static int check_output_paths(BatchState *state) {
+  OutputName *names = calloc(state->num_inputs, sizeof(OutputName));
+  int i, status = 0;
+
+  if (names == NULL)
+    return -1;
+  for (i = 0; i < state->num_inputs; i++) {
+    names[i].input = state->inputs[i];
+    names[i].stem = output_stem(state->inputs[i]);
+    if (names[i].stem == NULL) {
+      fprintf(stderr, "xslt-batch: %s: invalid output path\n",
+              state->inputs[i]);
+      status = -1;
+    }
+  }
+  if (status == 0) {
+    qsort(names, state->num_inputs, sizeof(OutputName), compare_output_names);
+    for (i = 1; i < state->num_inputs; i++) {
+      if (strcmp(names[i - 1].stem, names[i].stem) == 0) {
+        fprintf(stderr, "xslt-batch: %s and %s would be written to the same "
+                        "output file\n",
+                names[i - 1].input, names[i].input);
+        status = -1;
+      }
+    }
+  }
+  for (i = 0; i < state->num_inputs; i++)
+    free(names[i].stem);
+  free(names);
+  return status;
+}
+
+// Creates all missing parent directories of `path`.
+static int make_parent_dirs(char *path) {
+  char *sep;
+
+  for (sep = strchr(path + 1, '/'); sep != NULL; sep = strchr(sep + 1, '/')) {
+    *sep = '\0';
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+      *sep = '/';
+      return -1;
+    }
+    *sep = '/';
+  }
+  return 0;
+}
+
+// Serializes a result document straight to its output file, or to a
+// discarded string when no output directory was given.
+static int write_result(BatchState *state, const char *input,
+                        xmlDocPtr result_doc, const char *mime_type) {
+  char *path;
+  FILE *out;
+  int ok;
+
+  if (state->out_dir == NULL) {
+    xmlChar *buffer = NULL;
+    int len = 0;
+    ok = xsltSaveResultToString(&buffer, &len, result_doc, state->sheet) == 0;
+    xmlFree(buffer);
+    return ok;
+  }
+
+  path = output_path(state->out_dir, input, mime_type);
+  if (path == NULL) {
+    fprintf(stderr, "xslt-batch: %s: invalid output path\n", input);
+    return 0;
+  }
+  if (make_parent_dirs(path) != 0 || (out = fopen(path, "wb")) == NULL) {
+    fprintf(stderr, "xslt-batch: %s: %s\n", path, strerror(errno));
+    free(path);
+    return 0;
+  }
+  ok = xsltSaveResultToFile(out, result_doc, state->sheet) >= 0;
+  ok = (fclose(out) == 0) && ok;
+  if (!ok)
+    fprintf(stderr, "xslt-batch: %s: failed to write result\n", path);
+  free(path);
+  return ok;
+}
+
+static char *read_file(const char *path, long *out_len) {
+  FILE *file = fopen(path, "rb");
+  char *content = NULL;
+  long len;
+
+  if (file == NULL)
+    return NULL;
+  if (fseek(file, 0, SEEK_END) == 0 && (len = ftell(file)) >= 0 &&
+      fseek(file, 0, SEEK_SET) == 0) {
+    content = malloc(len + 1);
+    if (content && fread(content, 1, len, file) != (size_t)len) {
+      free(content);
+      content = NULL;
+    }
+    if (content) {
+      content[len] = '\0';
+      *out_len = len;
+    }
+  }
+  fclose(file);
+  return content;
+}
+
+static int transform_file(BatchState *state, const char *input) {
+  xmlDocPtr xml_doc;
+  xmlDocPtr result_doc;
+  char mime_type[32] = {0};
+  char *content;
+  long len = 0;
+  int ok;
+
+  // Read the input directly rather than with xmlReadFile(), so that files
+  // named on the command line aren't subject to the --read-root policy.
+  content = read_file(input, &len);
+  if (content == NULL) {
+    fprintf(stderr, "xslt-batch: %s: %s\n", input, strerror(errno));
+    return 0;
+  }
+  xml_doc = xmlReadMemory(content, (int)len, input, NULL, XML_PARSE_HUGE);
+  free(content);
+  if (xml_doc == NULL) {
+    fprintf(stderr, "xslt-batch: %s: failed to parse XML document\n", input);
+    return 0;
+  }
+
+  result_doc = xslt_polyfill_apply_stylesheet(state->sheet, xml_doc,
+                                              state->params, mime_type, NULL);
+  ok = result_doc != NULL && write_result(state, input, result_doc, mime_type);
+  if (!ok && result_doc == NULL)
+    fprintf(stderr, "xslt-batch: %s: transformation failed\n", input);
+
+  if (result_doc != xml_doc)
+    xmlFreeDoc(result_doc);
+  xmlFreeDoc(xml_doc);
+  return ok;
+}
+
+static void *worker_main(void *arg) {
+  Worker *worker = (Worker *)arg;
+  BatchState *state = worker->state;
+  int job;
+
+  while (next_job(worker, &job)) {
+    if (transform_file(state, state->inputs[job]))
+      atomic_fetch_add(&state->succeeded, 1);
+    else
+      atomic_fetch_add(&state->failed, 1);
+  }
+  xslt_polyfill_thread_cleanup();
+  return NULL;
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Transforms every input with `num_threads` worker threads.
+ *
+ * Inputs are split into contiguous chunks, one per worker queue, and workers
+ * steal from each other once their own chunk is done.
+ *
+ * @return The elapsed wall-clock time in seconds, or a negative value if the
+ * thread pool could not be started.
+ */
+static double run_batch(BatchState *state, int num_threads) {
+  pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+  Worker *workers = calloc(num_threads, sizeof(Worker));
+  WorkQueue *queues = calloc(num_threads, sizeof(WorkQueue));
+  int *jobs = malloc(state->num_inputs * sizeof(int));
+  double start, elapsed = -1;
+  int started = 0;
+  int i;
+
+  if (!threads || !workers || !queues || !jobs)
+    goto cleanup;
+
+  for (i = 0; i < state->num_inputs; i++)
+    jobs[i] = i;
+  for (i = 0; i < num_threads; i++) {
+    pthread_mutex_init(&queues[i].lock, NULL);
+    queues[i].jobs = jobs;
+    queues[i].head = (int)((long long)state->num_inputs * i / num_threads);
+    queues[i].tail =
+        (int)((long long)state->num_inputs * (i + 1) / num_threads);
+    workers[i].state = state;
+    workers[i].index = i;
+  }
+  state->queues = queues;
+  state->num_threads = num_threads;
+  atomic_store(&state->succeeded, 0);
+  atomic_store(&state->failed, 0);
+
+  start = now_seconds();
+  for (i = 0; i < num_threads; i++) {
+    if (pthread_create(&threads[i], NULL, worker_main, &workers[i]) != 0) {
+      fprintf(stderr, "xslt-batch: failed to start worker thread\n");
+      break;
+    }
+    started++;
+  }
+  // If some threads failed to start, the running ones steal their jobs.
+  for (i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  if (started > 0)
+    elapsed = now_seconds() - start;
+
+  for (i = 0; i < num_threads; i++)
+    pthread_mutex_destroy(&queues[i].lock);
+
+cleanup:
+  state->queues = NULL;
+  free(jobs);
+  free(queues);
+  free(workers);
+  free(threads);
+  return elapsed;
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [options] stylesheet.xsl input.xml...\n"
+          "\n"
+          "Options:\n"
+          "  -j N            Use N worker threads (default: number of cores).\n"
+          "  -o DIR          Write results under DIR, mirroring input paths.\n"
+          "                  Without -o, results are serialized and dropped.\n"
+          "  -p NAME VALUE   Set a top-level parameter to a literal string.\n"
+          "  --read-root DIR Only let the stylesheet read files under DIR\n"
+          "                  (default: the current directory).\n"
+          "  --allow-network Let the stylesheet read network URLs.\n"
+          "  --bench         Run the batch with 1, 2, 4, ... N threads and\n"
+          "                  report files/s for each.\n",
+          argv0);
+}
+
+int main(int argc, char **argv) {
+  BatchState state;
+  const char *params[2 * MAX_PARAMS + 1];
+  int num_params = 0;
+  int max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  int bench = 0;
+  const char *read_root = ".";
+  int allow_network = 0;
+  const char *stylesheet_path = NULL;
+  char *xslt_content;
+  long xslt_len = 0;
+  int i, status = 0;
+
+  memset(&state, 0, sizeof(state));
+  state.inputs = calloc(argc, sizeof(char *));
+  if (state.inputs == NULL)
+    return 1;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      max_threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      state.out_dir = argv[++i];
+    } else if (strcmp(argv[i], "-p") == 0 && i + 2 < argc) {
+      if (num_params == MAX_PARAMS) {
+        fprintf(stderr, "xslt-batch: too many parameters\n");
+        return 1;
+      }
+      params[2 * num_params] = argv[++i];
+      params[2 * num_params + 1] = argv[++i];
+      num_params++;
+    } else if (strcmp(argv[i], "--read-root") == 0 && i + 1 < argc) {
+      read_root = argv[++i];
+    } else if (strcmp(argv[i], "--allow-network") == 0) {
+      allow_network = 1;
+    } else if (strcmp(argv[i], "--bench") == 0) {
+      bench = 1;
+    } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      usage(argv[0]);
+      return 1;
+    } else if (stylesheet_path == NULL) {
+      stylesheet_path = argv[i];
+    } else {
+      state.inputs[state.num_inputs++] = argv[i];
+    }
+  }
+  params[2 * num_params] = NULL;
+  if (stylesheet_path == NULL || state.num_inputs == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (max_threads < 1)
+    max_threads = 1;
+  if (state.out_dir != NULL && check_output_paths(&state) != 0)
+    return 1;
+  if (state.out_dir != NULL &&
+      mkdir(state.out_dir, 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "xslt-batch: %s: %s\n", state.out_dir, strerror(errno));
+    return 1;
+  }
+
+  // All global library setup must happen before any worker thread starts.
+  xslt_polyfill_init();
+  if (xslt_polyfill_set_read_policy(read_root, allow_network) != 0) {
+    fprintf(stderr, "xslt-batch: %s: %s\n", read_root, strerror(errno));
+    return 1;
+  }
+
+  xslt_content = read_file(stylesheet_path, &xslt_len);
+  if (xslt_content == NULL) {
+    fprintf(stderr, "xslt-batch: %s: %s\n", stylesheet_path, strerror(errno));
+    return 1;
+  }
+  state.sheet = xslt_polyfill_parse_stylesheet(xslt_content, (int)xslt_len,
+                                               stylesheet_path, 0);
+  free(xslt_content);
+  if (state.sheet == NULL)
+    return 1;
+  state.params = num_params ? params : NULL;
+
+  if (bench) {
+    double base_rate = 0;
+    int threads = 1;
+    printf("%8s %12s %8s\n", "threads", "files/s", "speedup");
+    for (;;) {
+      double elapsed = run_batch(&state, threads);
+      double rate;
+      if (elapsed < 0) {
+        status = 1;
+        break;
+      }
+      rate = state.num_inputs / (elapsed > 0 ? elapsed : 1e-9);
+      if (threads == 1)
+        base_rate = rate;
+      printf("%8d %12.1f %7.2fx\n", threads, rate, rate / base_rate);
+      fflush(stdout);
+      if (atomic_load(&state.failed) > 0)
+        status = 1;
+      if (threads == max_threads)
+        break;
+      threads = (threads * 2 < max_threads) ? threads * 2 : max_threads;
+    }
+  } else {
+    double elapsed = run_batch(&state, max_threads);
+    if (elapsed < 0) {
+      status = 1;
+    } else {
+      printf("Transformed %d of %d files with %d threads in %.3fs "
+             "(%.1f files/s)\n",
+             atomic_load(&state.succeeded), state.num_inputs, max_threads,
+             elapsed, state.num_inputs / (elapsed > 0 ? elapsed : 1e-9));
+      if (atomic_load(&state.failed) > 0)
+        status = 1;
+    }
+  }
+
+  xsltFreeStylesheet(state.sheet);
+  free(state.inputs);
+  xsltCleanupGlobals();
+  xmlCleanupParser();
+  return status;
+}
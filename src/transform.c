@@ -1,17 +1,26 @@
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
+#ifdef __EMSCRIPTEN__
 // Emscripten header for exporting functions
 #include <emscripten.h>
+#else
+#include <locale.h>
+#include <stdlib.h>
+#endif
 
 // Libxml2 and Libxslt headers
 #include <libexslt/exslt.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
+#include <libxml/uri.h>
 #include <libxml/xmlstring.h>
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
 #include <libxslt/documents.h>
+#include <libxslt/extensions.h>
 #include <libxslt/imports.h>
 #include <libxslt/security.h>
 #include <libxslt/templates.h>
@@ -21,13 +30,19 @@
 #include <libxslt/variables.h>
 #include <libxslt/xsltutils.h>
 
+#include "transform.h"
+
+#ifdef __EMSCRIPTEN__
 // Forward declaration for our JS fetch function.
 const char *fetch_and_load_document(const char *url);
 
 // Use EM_JS to define a JavaScript function that can be called from C.
 // This function will use the fetch API to get a document from a URL.
 // It uses Asyncify to pause the C code and wait for the async JS to complete.
+// Each load is counted in Module.externalLoadCount, so that the polyfill's
+// result cache can tell when an output depends on fetched documents.
 EM_JS(const char *, fetch_and_load_document, (const char *url), {
+  Module.externalLoadCount = (Module.externalLoadCount || 0) + 1;
   return Asyncify.handleSleep(function(wakeUp) {
     fetch(UTF8ToString(url))
         .then(function(response) {
@@ -98,6 +113,103 @@ EM_JS(int, js_collate,
           return 0;
         }
       });
+#else
+// Native builds have no Intl.Collator, so approximate it with the C library's
+// locale-aware collation. Each thread caches the locale for the last `lang`
+// it saw, since sorts almost always compare many strings in one language.
+static _Thread_local char collate_lang[64];
+static _Thread_local locale_t collate_locale = (locale_t)0;
+static _Thread_local int collate_locale_valid = 0;
+
+static locale_t native_collate_locale(const char *lang) {
+  char name[80];
+  size_t i;
+
+  if (lang == NULL)
+    lang = "";
+  if (collate_locale_valid && strcmp(collate_lang, lang) == 0)
+    return collate_locale;
+
+  if (collate_locale_valid && collate_locale != (locale_t)0)
+    freelocale(collate_locale);
+  collate_locale = (locale_t)0;
+  snprintf(collate_lang, sizeof(collate_lang), "%s", lang);
+  collate_locale_valid = 1;
+
+  // Map a BCP 47 tag like "en-US" to a POSIX locale name like "en_US.UTF-8".
+  if (lang[0] != '\0') {
+    snprintf(name, sizeof(name), "%s.UTF-8", lang);
+    for (i = 0; name[i] != '\0' && name[i] != '.'; i++) {
+      if (name[i] == '-')
+        name[i] = '_';
+    }
+    collate_locale = newlocale(LC_COLLATE_MASK, name, (locale_t)0);
+  }
+  if (collate_locale == (locale_t)0)
+    collate_locale = newlocale(LC_COLLATE_MASK, "", (locale_t)0);
+  if (collate_locale == (locale_t)0)
+    collate_locale = newlocale(LC_COLLATE_MASK, "C.UTF-8", (locale_t)0);
+  return collate_locale;
+}
+
+// Releases the calling thread's cached collation locale.
+void xslt_polyfill_thread_cleanup(void) {
+  if (collate_locale_valid && collate_locale != (locale_t)0)
+    freelocale(collate_locale);
+  collate_locale = (locale_t)0;
+  collate_locale_valid = 0;
+}
+
+// Returns a copy of `str` with ASCII letters lowercased.
+static char *native_collate_fold(const char *str) {
+  char *folded = (char *)xmlStrdup((const xmlChar *)str);
+  char *p;
+
+  for (p = folded; p && *p; p++) {
+    if (*p >= 'A' && *p <= 'Z')
+      *p += 'a' - 'A';
+  }
+  return folded;
+}
+
+static int native_collate(const char *s1, const char *s2, const char *lang,
+                          int lower_first) {
+  locale_t loc;
+  char *f1, *f2;
+  int tst = 0;
+  size_t i;
+
+  if (s1 == NULL)
+    s1 = "";
+  if (s2 == NULL)
+    s2 = "";
+  loc = native_collate_locale(lang);
+
+  // Like Intl.Collator, compare letters case-insensitively first, and only
+  // use case to order strings that are otherwise equal.
+  f1 = native_collate_fold(s1);
+  f2 = native_collate_fold(s2);
+  if (f1 && f2)
+    tst = (loc != (locale_t)0) ? strcoll_l(f1, f2, loc) : strcmp(f1, f2);
+  xmlFree(f1);
+  xmlFree(f2);
+  if (tst != 0)
+    return tst;
+
+  // Lowercase sorts first unless the stylesheet asks for upper-first.
+  for (i = 0; s1[i] != '\0' && s1[i] == s2[i]; i++)
+    ;
+  if (s1[i] == s2[i])
+    return 0;
+  if ((s1[i] >= 'a' && s1[i] <= 'z') || (s2[i] >= 'A' && s2[i] <= 'Z'))
+    tst = -1;
+  else if ((s1[i] >= 'A' && s1[i] <= 'Z') || (s2[i] >= 'a' && s2[i] <= 'z'))
+    tst = 1;
+  else
+    return strcmp(s1, s2);
+  return (lower_first == 0) ? -tst : tst;
+}
+#endif // __EMSCRIPTEN__
 
 static int xslt_polyfill_compare_objects(xmlXPathObjectPtr res1,
                                          xmlXPathObjectPtr res2, int number,
@@ -125,8 +237,13 @@ static int xslt_polyfill_compare_objects(xmlXPathObjectPtr res1,
       else
         tst = -1;
     } else {
+#ifdef __EMSCRIPTEN__
       tst = js_collate((const char *)res1->stringval,
                        (const char *)res2->stringval, lang, lower_first);
+#else
+      tst = native_collate((const char *)res1->stringval,
+                           (const char *)res2->stringval, lang, lower_first);
+#endif
     }
     if (desc)
       tst = -tst;
@@ -367,24 +484,1149 @@ cleanup:
   }
 }
 
+#ifndef __EMSCRIPTEN__
+// libxslt's built-in loader, saved by xslt_polyfill_init() before it installs
+// docLoader. The public xsltDocDefaultLoader pointer can't be called from
+// docLoader, because it points back to docLoader once installed.
+static xsltDocLoaderFunc native_default_loader = NULL;
+
+// The policy set by xslt_polyfill_set_read_policy(). The Wasm build reads
+// everything through fetch(), which enforces the browser's same-origin policy,
+// but native builds read straight from the file system and network, so they
+// only read files under native_read_root, and the network only if allowed.
+static char *native_read_root = NULL;
+static int native_allow_network = 0;
+
+// libxml2's entity loader, wrapped by native_policy_entity_loader().
+static xmlExternalEntityLoader native_entity_loader = NULL;
+
+int xslt_polyfill_set_read_policy(const char *read_root, int allow_network) {
+  char *root = NULL;
+
+  if (read_root != NULL) {
+    root = realpath(read_root, NULL);
+    if (root == NULL)
+      return -1;
+  }
+  free(native_read_root);
+  native_read_root = root;
+  native_allow_network = allow_network;
+  return 0;
+}
+
+// Returns whether the local file at `path` is under the read root.
+static int native_file_read_allowed(const char *path) {
+  char *resolved;
+  size_t len;
+  int allowed;
+
+  if (native_read_root == NULL || path == NULL)
+    return 0;
+  resolved = realpath(path, NULL);
+  if (resolved == NULL)
+    return 0;
+  len = strlen(native_read_root);
+  allowed = strncmp(resolved, native_read_root, len) == 0 &&
+            (resolved[len] == '\0' || resolved[len] == '/' ||
+             native_read_root[len - 1] == '/');
+  free(resolved);
+  return allowed;
+}
+
+// Returns whether `url` may be read under the read policy. URLs without a
+// scheme are local paths, as in libxslt's xsltCheckRead().
+static int native_read_allowed(const char *url) {
+  xmlURIPtr uri = xmlParseURI(url);
+  int allowed;
+
+  if (uri == NULL)
+    return native_file_read_allowed(url);
+  if (uri->scheme == NULL || xmlStrEqual((const xmlChar *)uri->scheme,
+                                         (const xmlChar *)"file"))
+    allowed = native_file_read_allowed(uri->path);
+  else
+    allowed = native_allow_network;
+  xmlFreeURI(uri);
+  return allowed;
+}
+
+// Security check for XSLT_SECPREF_READ_FILE, called with the file's path.
+static int native_check_read_file(xsltSecurityPrefsPtr sec,
+                                  xsltTransformContextPtr ctxt,
+                                  const char *value) {
+  (void)sec;
+  (void)ctxt;
+  return native_file_read_allowed(value);
+}
+
+// Applies the read policy to every document libxml2 loads by URL, which
+// covers includes, imports and external entities as well as document().
+static xmlParserInputPtr native_policy_entity_loader(const char *URL,
+                                                     const char *ID,
+                                                     xmlParserCtxtPtr ctxt) {
+  if (URL != NULL && !native_read_allowed(URL)) {
+    printf("XSLT Transformation Error: Read access to %s denied.\n", URL);
+    return NULL;
+  }
+  return native_entity_loader(URL, ID, ctxt);
+}
+#endif
+
+// Template memoization for incremental transformations.
+//
+// When a stylesheet is parsed with `memoize` set, the body of each
+// xsl:template (everything after its xsl:param elements) is wrapped in a
+// <memo:template> extension element. Each instantiation of that element is
+// keyed by the template, the context node, the context position and size, the
+// mode and the values of the template's parameters, and records which global
+// parameters it (or anything it instantiates) read. A later run with the same
+// XsltPolyfillMemo copies in the output saved for a key, instead of executing
+// the template again, unless one of those global parameters changed.
+
+#define MEMO_NS ((const xmlChar *)"urn:xslt-polyfill:memo")
+#define MEMO_PREFIX ((const xmlChar *)"xsltpolyfillmemo")
+
+// Output saved from one template instantiation.
+typedef struct MemoEntry {
+  // The run that last produced or used this entry.
+  unsigned long generation;
+  // For each global parameter, whether the instantiation read it, and if so
+  // the value it saw.
+  unsigned char *reads;
+  const xmlChar **values;
+  // Text appended to the text node that preceded the output, and that node's
+  // name (xmlStringText or xmlStringTextNoenc).
+  xmlChar *lead;
+  const xmlChar *lead_name;
+  // An element in XsltPolyfillMemo.doc whose children are copies of the
+  // output. Each copied element's `extra` is the number of its namespace
+  // declarations that were in the output, rather than added by the copy.
+  xmlNodePtr nodes;
+  // The entries for nested instantiations, which are kept as long as this
+  // entry is.
+  struct MemoEntry **children;
+  int num_children;
+  // References from XsltPolyfillMemo.entries and from other entries.
+  int refs;
+} MemoEntry;
+
+struct XsltPolyfillMemo {
+  xmlHashTablePtr entries;
+  xmlDictPtr dict;
+  xmlDocPtr doc;
+  // Maps each global parameter name passed so far to its index + 1.
+  xmlHashTablePtr params;
+  int num_params;
+  unsigned long generation;
+  int reused;
+  int executed;
+};
+
+// A template instantiation that is executing.
+typedef struct {
+  unsigned char *reads;
+  MemoEntry **children;
+  int num_children;
+  int max_children;
+} MemoFrame;
+
+// The state of one memoized transformation, kept in ctxt->_private.
+typedef struct {
+  XsltPolyfillMemo *memo;
+  xmlDocPtr source;
+  xsltStylesheetPtr style;
+  // The current value of each global parameter, interned in memo->dict.
+  const xmlChar **values;
+  // Which global parameters each global variable depends on.
+  xmlHashTablePtr globals;
+  unsigned char *all;
+  // Reused to build keys.
+  xmlBufferPtr key;
+  MemoFrame *frames;
+  int depth;
+  int max_depth;
+} MemoRun;
+
+// Marks a global variable whose dependencies are being computed.
+static unsigned char memo_visiting;
+
+static void memo_release_entry(void *payload, const xmlChar *name) {
+  MemoEntry *entry = (MemoEntry *)payload;
+  int i;
+  (void)name;
+  if (entry == NULL || --entry->refs > 0)
+    return;
+  xmlFree(entry->reads);
+  xmlFree(entry->values);
+  xmlFree(entry->lead);
+  if (entry->nodes != NULL) {
+    xmlUnlinkNode(entry->nodes);
+    xmlFreeNode(entry->nodes);
+  }
+  for (i = 0; i < entry->num_children; i++)
+    memo_release_entry(entry->children[i], NULL);
+  xmlFree(entry->children);
+  xmlFree(entry);
+}
+
+static void memo_free_deps(void *payload, const xmlChar *name) {
+  (void)name;
+  if (payload != &memo_visiting)
+    xmlFree(payload);
+}
+
+// Forgets every saved instantiation and parameter.
+static void memo_clear(XsltPolyfillMemo *memo) {
+  xmlHashFree(memo->entries, memo_release_entry);
+  xmlHashFree(memo->params, NULL);
+  memo->entries = xmlHashCreate(64);
+  memo->params = xmlHashCreate(8);
+  memo->num_params = 0;
+}
+
+/**
+ * @brief Creates the state that lets transformations of one source document
+ * reuse output from earlier transformations with other parameters.
+ *
+ * Pass it to xslt_polyfill_apply_stylesheet() with a stylesheet parsed with
+ * `memoize` set. Every transformation using a memo must use the same source
+ * document and stylesheet, and must not use generate-id(), document() or any
+ * other function whose result can change between runs.
+ *
+ * @return The memo, to be freed with xslt_polyfill_memo_free(), or NULL on
+ * error.
+ */
+XsltPolyfillMemo *xslt_polyfill_memo_new(void) {
+  XsltPolyfillMemo *memo =
+      (XsltPolyfillMemo *)xmlMalloc(sizeof(XsltPolyfillMemo));
+  if (memo == NULL)
+    return NULL;
+  memset(memo, 0, sizeof(XsltPolyfillMemo));
+  memo->dict = xmlDictCreate();
+  memo->doc = xmlNewDoc((const xmlChar *)"1.0");
+  memo->entries = xmlHashCreate(64);
+  memo->params = xmlHashCreate(8);
+  if (memo->dict == NULL || memo->doc == NULL || memo->entries == NULL ||
+      memo->params == NULL) {
+    xslt_polyfill_memo_free(memo);
+    return NULL;
+  }
+  return memo;
+}
+
+void xslt_polyfill_memo_free(XsltPolyfillMemo *memo) {
+  if (memo == NULL)
+    return;
+  xmlHashFree(memo->entries, memo_release_entry);
+  xmlHashFree(memo->params, NULL);
+  if (memo->doc)
+    xmlFreeDoc(memo->doc);
+  if (memo->dict)
+    xmlDictFree(memo->dict);
+  xmlFree(memo);
+}
+
+// The number of template instantiations the last transformation using `memo`
+// reused from an earlier one, and the number it executed.
+int xslt_polyfill_memo_reused(const XsltPolyfillMemo *memo) {
+  return memo->reused;
+}
+
+int xslt_polyfill_memo_executed(const XsltPolyfillMemo *memo) {
+  return memo->executed;
+}
+
+// Appends MEMO_PREFIX to the space-separated prefix list in `attr` of `root`.
+static void memo_append_prefix(xmlNodePtr root, const char *attr) {
+  xmlChar *value = xmlGetNoNsProp(root, (const xmlChar *)attr);
+  if (value != NULL)
+    value = xmlStrcat(value, (const xmlChar *)" ");
+  value = xmlStrcat(value, MEMO_PREFIX);
+  xmlSetProp(root, (const xmlChar *)attr, value);
+  xmlFree(value);
+}
+
+// Wraps the body of each template in the stylesheet module `doc` in a
+// <memo:template> element. The wrappers are numbered in document order, so
+// the same module always gets the same ids. Simplified stylesheets, and ones
+// already using our prefix, are left alone.
+static void memo_rewrite_stylesheet(xmlDocPtr doc) {
+  xmlNodePtr root = xmlDocGetRootElement(doc);
+  xmlNodePtr templ;
+  xmlNsPtr ns;
+  int count = 0;
+
+  if (!IS_XSLT_ELEM(root) || !(IS_XSLT_NAME(root, "stylesheet") ||
+                               IS_XSLT_NAME(root, "transform")))
+    return;
+  if (xmlSearchNs(doc, root, MEMO_PREFIX) != NULL)
+    return;
+  ns = xmlNewNs(root, MEMO_NS, MEMO_PREFIX);
+  if (ns == NULL)
+    return;
+  memo_append_prefix(root, "extension-element-prefixes");
+  memo_append_prefix(root, "exclude-result-prefixes");
+
+  for (templ = root->children; templ != NULL; templ = templ->next) {
+    xmlNodePtr body = templ->children;
+    xmlNodePtr cur, wrapper;
+    char id[32];
+    xmlChar *id_value;
+
+    if (!IS_XSLT_ELEM(templ) || !IS_XSLT_NAME(templ, "template"))
+      continue;
+    count++;
+    for (cur = templ->children; cur != NULL; cur = cur->next) {
+      if (cur->type == XML_ELEMENT_NODE) {
+        if (!IS_XSLT_ELEM(cur) || !IS_XSLT_NAME(cur, "param"))
+          break;
+        body = cur->next;
+      } else if (cur->type != XML_COMMENT_NODE && !xmlIsBlankNode(cur)) {
+        break;
+      }
+    }
+    if (body == NULL)
+      continue;
+
+    wrapper = xmlNewDocNode(doc, ns, (const xmlChar *)"template", NULL);
+    if (wrapper == NULL)
+      return;
+    snprintf(id, sizeof(id), "#%d", count);
+    id_value = xmlStrdup(doc->URL != NULL ? doc->URL : (const xmlChar *)"");
+    id_value = xmlStrcat(id_value, (const xmlChar *)id);
+    xmlSetProp(wrapper, (const xmlChar *)"id", id_value);
+    xmlFree(id_value);
+
+    // Move `body` and its following siblings into the wrapper.
+    wrapper->parent = templ;
+    wrapper->prev = body->prev;
+    if (body->prev != NULL)
+      body->prev->next = wrapper;
+    else
+      templ->children = wrapper;
+    wrapper->children = body;
+    wrapper->last = templ->last;
+    templ->last = wrapper;
+    body->prev = NULL;
+    for (cur = body; cur != NULL; cur = cur->next)
+      cur->parent = wrapper;
+  }
+}
+
+// Returns whether memo_rewrite_stylesheet() rewrote the main module of
+// `style`, so that the modules it includes or imports should be too.
+static int memo_stylesheet_rewritten(xsltStylesheetPtr style) {
+  xmlNodePtr root;
+  xmlNsPtr ns;
+  if (style == NULL || style->doc == NULL)
+    return 0;
+  root = xmlDocGetRootElement(style->doc);
+  for (ns = root != NULL ? root->nsDef : NULL; ns != NULL; ns = ns->next) {
+    if (xmlStrEqual(ns->prefix, MEMO_PREFIX) && xmlStrEqual(ns->href, MEMO_NS))
+      return 1;
+  }
+  return 0;
+}
+
+// Appends `tag` followed by `value` in decimal.
+static void memo_add_number(xmlBufferPtr buf, char tag, ptrdiff_t value) {
+  char digits[24];
+  int i = sizeof(digits);
+  int negative = value < 0;
+  size_t magnitude = negative ? -(size_t)value : (size_t)value;
+  do {
+    digits[--i] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude != 0);
+  if (negative)
+    digits[--i] = '-';
+  digits[--i] = tag;
+  xmlBufferAdd(buf, (const xmlChar *)digits + i, sizeof(digits) - i);
+}
+
+// Appends `tag` followed by `str`, prefixed with its length.
+static void memo_add_string(xmlBufferPtr buf, char tag, const xmlChar *str) {
+  int len = xmlStrlen(str);
+  memo_add_number(buf, tag, len);
+  xmlBufferAdd(buf, (const xmlChar *)":", 1);
+  if (len > 0)
+    xmlBufferAdd(buf, str, len);
+}
+
+// Appends an identifier for the source document node `node` that is the
+// same in every parse of the source. Returns 0 if it has none.
+static int memo_add_node_id(xmlBufferPtr buf, xmlDocPtr source,
+                            xmlNodePtr node) {
+  xmlNodePtr anchor;
+  int offset = 0;
+
+  if (node == NULL || node->doc != source)
+    return 0;
+  switch (node->type) {
+  case XML_DOCUMENT_NODE:
+  case XML_HTML_DOCUMENT_NODE:
+    xmlBufferAdd(buf, (const xmlChar *)"/", 1);
+    return 1;
+  case XML_ELEMENT_NODE:
+    // xmlXPathOrderDocElems() numbered the elements in document order.
+    if (-(ptrdiff_t)node->content <= 0)
+      return 0;
+    memo_add_number(buf, 'e', -(ptrdiff_t)node->content);
+    return 1;
+  case XML_ATTRIBUTE_NODE:
+    if (!memo_add_node_id(buf, source, node->parent))
+      return 0;
+    memo_add_string(buf, '@', ((xmlAttrPtr)node)->ns != NULL
+                                  ? ((xmlAttrPtr)node)->ns->href
+                                  : NULL);
+    memo_add_string(buf, ':', node->name);
+    return 1;
+  case XML_TEXT_NODE:
+  case XML_CDATA_SECTION_NODE:
+  case XML_COMMENT_NODE:
+  case XML_PI_NODE:
+    // Count from the preceding element sibling, or else from the parent.
+    for (anchor = node->prev; anchor != NULL; anchor = anchor->prev) {
+      offset++;
+      if (anchor->type == XML_ELEMENT_NODE)
+        break;
+    }
+    if (anchor == NULL)
+      anchor = node->parent;
+    if (!memo_add_node_id(buf, source, anchor))
+      return 0;
+    memo_add_number(buf, '+', offset);
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+// Appends a serialization of the parameter value `value`. Returns 0 if it
+// can't be serialized.
+static int memo_add_value(xmlBufferPtr buf, xmlDocPtr source,
+                          xmlXPathObjectPtr value) {
+  char num[48];
+  int i;
+  xmlNodeSetPtr nodes;
+
+  if (value == NULL)
+    return 0;
+  nodes = value->nodesetval;
+  switch (value->type) {
+  case XPATH_BOOLEAN:
+    xmlBufferCCat(buf, value->boolval ? "b1" : "b0");
+    return 1;
+  case XPATH_NUMBER:
+    snprintf(num, sizeof(num), "n%.17g", value->floatval);
+    xmlBufferCCat(buf, num);
+    return 1;
+  case XPATH_STRING:
+    memo_add_string(buf, 's', value->stringval);
+    return 1;
+  case XPATH_NODESET:
+    memo_add_number(buf, 'N', nodes != NULL ? nodes->nodeNr : 0);
+    for (i = 0; nodes != NULL && i < nodes->nodeNr; i++) {
+      xmlBufferAdd(buf, (const xmlChar *)",", 1);
+      if (!memo_add_node_id(buf, source, nodes->nodeTab[i]))
+        return 0;
+    }
+    return 1;
+  case XPATH_XSLT_TREE: {
+    // Result tree fragments are compared by their serialization.
+    xmlBufferPtr tree = xmlBufferCreate();
+    xmlNodePtr cur;
+    if (tree == NULL)
+      return 0;
+    for (i = 0; nodes != NULL && i < nodes->nodeNr; i++) {
+      for (cur = nodes->nodeTab[i]->children; cur != NULL; cur = cur->next)
+        xmlNodeDump(tree, cur->doc, cur, 0, 0);
+    }
+    memo_add_string(buf, 'T', xmlBufferContent(tree));
+    xmlBufferFree(tree);
+    return 1;
+  }
+  default:
+    return 0;
+  }
+}
+
+// Builds the key of the instantiation of the memo element `inst` for `node`
+// in run->key. Returns 0 if it can't be memoized.
+static int memo_key(MemoRun *run, xsltTransformContextPtr ctxt,
+                    xmlNodePtr node, xmlNodePtr inst) {
+  xmlAttrPtr id = xmlHasProp(inst, (const xmlChar *)"id");
+  xmlBufferPtr buf = run->key;
+  int i;
+
+  if (id == NULL || id->children == NULL)
+    return 0;
+  xmlBufferEmpty(buf);
+  memo_add_string(buf, 't', id->children->content);
+  if (!memo_add_node_id(buf, run->source, node))
+    return 0;
+  memo_add_number(buf, 'p', ctxt->xpathCtxt->proximityPosition);
+  memo_add_number(buf, '/', ctxt->xpathCtxt->contextSize);
+  memo_add_string(buf, 'm', ctxt->mode);
+  memo_add_string(buf, '{', ctxt->modeURI);
+  // The variables above varsBase are the template's parameters, since the
+  // memo element comes straight after them.
+  for (i = ctxt->varsBase; i < ctxt->varsNr; i++) {
+    xsltStackElemPtr param = ctxt->varsTab[i];
+    if (param == NULL || !param->computed)
+      return 0;
+    memo_add_string(buf, 'v', param->name);
+    memo_add_string(buf, '{', param->nameURI);
+    if (!memo_add_value(buf, run->source, param->value))
+      return 0;
+  }
+  return 1;
+}
+
+static int memo_name_start(xmlChar c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+         c >= 0x80;
+}
+
+static int memo_name_char(xmlChar c) {
+  return memo_name_start(c) || (c >= '0' && c <= '9') || c == '-' || c == '.';
+}
+
+// Extension functions that only depend on their arguments.
+static int memo_safe_function_ns(const xmlChar *uri) {
+  static const char *const safe[] = {
+      "http://exslt.org/common",  "http://exslt.org/math",
+      "http://exslt.org/sets",    "http://exslt.org/strings",
+      "http://exslt.org/dates-and-times",
+      "http://xmlsoft.org/XSLT/namespace",
+  };
+  size_t i;
+  for (i = 0; i < sizeof(safe) / sizeof(safe[0]); i++) {
+    if (xmlStrEqual(uri, (const xmlChar *)safe[i]))
+      return 1;
+  }
+  return 0;
+}
+
+static const unsigned char *memo_global_deps(MemoRun *run,
+                                             const xmlChar *name,
+                                             const xmlChar *ns_uri);
+
+static void memo_merge_reads(MemoRun *run, unsigned char *reads,
+                             const unsigned char *deps) {
+  int i;
+  for (i = 0; deps != NULL && i < run->memo->num_params; i++)
+    reads[i] |= deps[i];
+}
+
+// Adds the dependencies of the variables referenced by the XPath expression
+// or attribute value template `expr` on the stylesheet element `elem` to
+// `deps`. Returns 0 if the expression could depend on any parameter. This
+// errs on the side of finding references, e.g. inside string literals.
+static int memo_expression_deps(MemoRun *run, xmlNodePtr elem,
+                                const xmlChar *expr, unsigned char *deps) {
+  const xmlChar *p = expr;
+  while (p != NULL && *p != '\0') {
+    const xmlChar *name, *local = NULL;
+    int is_variable = 0;
+
+    if (*p == '$') {
+      is_variable = 1;
+      p++;
+    }
+    if (!memo_name_start(*p)) {
+      if (!is_variable)
+        p++;
+      continue;
+    }
+    name = p;
+    while (memo_name_char(*p))
+      p++;
+    if (p[0] == ':' && memo_name_start(p[1])) {
+      local = p + 1;
+      p = local;
+      while (memo_name_char(*p))
+        p++;
+    }
+
+    if (is_variable) {
+      xmlChar *var;
+      if (local != NULL)
+        return 0;
+      var = xmlStrndup(name, p - name);
+      memo_merge_reads(run, deps, memo_global_deps(run, var, NULL));
+      xmlFree(var);
+    } else if (local != NULL) {
+      // A prefixed name followed by "(" is an extension function call.
+      const xmlChar *q = p;
+      xmlChar *prefix;
+      xmlNsPtr ns;
+      while (*q == ' ' || *q == '\t' || *q == '\r' || *q == '\n')
+        q++;
+      if (*q != '(')
+        continue;
+      prefix = xmlStrndup(name, local - 1 - name);
+      ns = xmlSearchNs(elem->doc, elem, prefix);
+      xmlFree(prefix);
+      if (ns == NULL || !memo_safe_function_ns(ns->href))
+        return 0;
+    }
+  }
+  return 1;
+}
+
+// Adds the dependencies of the stylesheet subtree `node` to `deps`. Returns 0
+// if it could depend on any parameter.
+static int memo_subtree_deps(MemoRun *run, xmlNodePtr node,
+                             unsigned char *deps) {
+  xmlNodePtr cur = node;
+  while (cur != NULL) {
+    if (cur->type == XML_ELEMENT_NODE) {
+      xmlAttrPtr attr;
+      // Other templates and attribute sets aren't tracked here.
+      if (IS_XSLT_ELEM(cur) && (IS_XSLT_NAME(cur, "call-template") ||
+                                IS_XSLT_NAME(cur, "apply-templates") ||
+                                IS_XSLT_NAME(cur, "apply-imports")))
+        return 0;
+      for (attr = cur->properties; attr != NULL; attr = attr->next) {
+        xmlChar *value;
+        int ok;
+        if (xmlStrEqual(attr->name, (const xmlChar *)"use-attribute-sets"))
+          return 0;
+        value = xmlNodeListGetString(cur->doc, attr->children, 1);
+        ok = memo_expression_deps(run, cur, value, deps);
+        xmlFree(value);
+        if (!ok)
+          return 0;
+      }
+      if (cur->children != NULL) {
+        cur = cur->children;
+        continue;
+      }
+    }
+    while (cur != node && cur->next == NULL)
+      cur = cur->parent;
+    if (cur == node)
+      break;
+    cur = cur->next;
+  }
+  return 1;
+}
+
+// Returns which global parameters the global variable or parameter `name`
+// depends on, or NULL if there's no such global.
+static const unsigned char *memo_global_deps(MemoRun *run,
+                                             const xmlChar *name,
+                                             const xmlChar *ns_uri) {
+  XsltPolyfillMemo *memo = run->memo;
+  unsigned char *deps = xmlHashLookup2(run->globals, name, ns_uri);
+  xsltStylesheetPtr style;
+  xsltStackElemPtr elem = NULL;
+
+  if (deps == &memo_visiting)
+    return run->all;
+  if (deps != NULL)
+    return deps;
+  for (style = run->style; style != NULL && elem == NULL;
+       style = xsltNextImport(style)) {
+    for (elem = style->variables; elem != NULL; elem = elem->next) {
+      if (xmlStrEqual(elem->name, name) && xmlStrEqual(elem->nameURI, ns_uri))
+        break;
+    }
+  }
+  if (elem == NULL)
+    return NULL;
+
+  deps = (unsigned char *)xmlMalloc(memo->num_params + 1);
+  if (deps == NULL)
+    return run->all;
+  memset(deps, 0, memo->num_params + 1);
+  if (xmlHashAddEntry2(run->globals, name, ns_uri, &memo_visiting) != 0) {
+    xmlFree(deps);
+    return run->all;
+  }
+  if (elem->comp != NULL && elem->comp->type == XSLT_FUNC_PARAM &&
+      ns_uri == NULL) {
+    ptrdiff_t index = (ptrdiff_t)xmlHashLookup(memo->params, name);
+    if (index > 0)
+      deps[index - 1] = 1;
+  }
+  if (elem->comp == NULL || !memo_subtree_deps(run, elem->comp->inst, deps))
+    memset(deps, 1, memo->num_params);
+  xmlHashUpdateEntry2(run->globals, name, ns_uri, deps, NULL);
+  return deps;
+}
+
+// Returns whether `name` refers to a parameter or variable of the executing
+// template rather than a global.
+static int memo_is_local(xsltTransformContextPtr ctxt, const xmlChar *name,
+                         const xmlChar *ns_uri) {
+  int i;
+  for (i = ctxt->varsNr; i > ctxt->varsBase; i--) {
+    xsltStackElemPtr elem = ctxt->varsTab[i - 1];
+    if (elem != NULL && xmlStrEqual(elem->name, name) &&
+        xmlStrEqual(elem->nameURI, ns_uri))
+      return 1;
+  }
+  return 0;
+}
+
+// Records reads of global variables and parameters in the executing
+// instantiation, then looks the variable up as usual.
+static xmlXPathObjectPtr memo_variable_lookup(void *data, const xmlChar *name,
+                                              const xmlChar *ns_uri) {
+  xsltTransformContextPtr ctxt = (xsltTransformContextPtr)data;
+  MemoRun *run = (MemoRun *)ctxt->_private;
+  if (run != NULL && run->depth > 0 && !memo_is_local(ctxt, name, ns_uri)) {
+    memo_merge_reads(run, run->frames[run->depth - 1].reads,
+                     ns_uri == NULL ? memo_global_deps(run, name, ns_uri)
+                                    : run->all);
+  }
+  return xsltXPathVariableLookup(ctxt, name, ns_uri);
+}
+
+// Adds `entry` to the nested instantiations of `frame`, taking over a
+// reference to it.
+static void memo_add_child(MemoFrame *frame, MemoEntry *entry) {
+  if (frame->num_children == frame->max_children) {
+    int max = frame->max_children ? frame->max_children * 2 : 4;
+    MemoEntry **children = (MemoEntry **)xmlRealloc(
+        frame->children, max * sizeof(MemoEntry *));
+    if (children == NULL) {
+      memo_release_entry(entry, NULL);
+      return;
+    }
+    frame->children = children;
+    frame->max_children = max;
+  }
+  frame->children[frame->num_children++] = entry;
+}
+
+// Keeps `entry`, and the entries of its nested instantiations, in the memo.
+static void memo_mark_live(XsltPolyfillMemo *memo, MemoEntry *entry) {
+  int i;
+  if (entry->generation == memo->generation)
+    return;
+  entry->generation = memo->generation;
+  for (i = 0; i < entry->num_children; i++)
+    memo_mark_live(memo, entry->children[i]);
+}
+
+// Appends `node` to `parent`. Unlike xmlAddChild(), this never merges text
+// nodes, so the result has the same structure as the one saved.
+static void memo_link(xmlNodePtr parent, xmlNodePtr node) {
+  node->parent = parent;
+  node->prev = parent->last;
+  if (parent->last != NULL)
+    parent->last->next = node;
+  else
+    parent->children = node;
+  parent->last = node;
+}
+
+// Appends `text` to the output text node `target`, keeping libxslt's text
+// merging state consistent, as xsltAddTextString() does.
+static void memo_add_text(xsltTransformContextPtr ctxt, xmlNodePtr target,
+                          const xmlChar *text) {
+  int len = xmlStrlen(text);
+  if (ctxt->lasttext == target->content) {
+    if (ctxt->lasttuse + len + 1 > ctxt->lasttsize) {
+      int min_size = ctxt->lasttuse + len + 1;
+      int size = ctxt->lasttsize + (min_size < 100 ? 100 : min_size);
+      xmlChar *content = (xmlChar *)xmlRealloc(target->content, size);
+      if (content == NULL) {
+        ctxt->state = XSLT_STATE_STOPPED;
+        return;
+      }
+      ctxt->lasttsize = size;
+      ctxt->lasttext = content;
+      target->content = content;
+    }
+    memcpy(target->content + ctxt->lasttuse, text, len);
+    ctxt->lasttuse += len;
+    target->content[ctxt->lasttuse] = '\0';
+  } else {
+    xmlNodeAddContentLen(target, text, len);
+    ctxt->lasttext = target->content;
+    ctxt->lasttsize = ctxt->lasttuse = xmlStrlen(target->content);
+  }
+}
+
+// Removes the namespace declarations that copying the saved element `copy`
+// added, where `parent` already declares the same namespace.
+static void memo_drop_copied_ns(xmlNodePtr parent, xmlNodePtr copy,
+                                int kept) {
+  xmlNsPtr *link = &copy->nsDef;
+  while (*link != NULL) {
+    xmlNsPtr ns = *link;
+    xmlNsPtr in_scope;
+    xmlNodePtr cur;
+
+    if (kept-- > 0 || parent->type != XML_ELEMENT_NODE ||
+        (in_scope = xmlSearchNs(parent->doc, parent, ns->prefix)) == NULL ||
+        !xmlStrEqual(in_scope->href, ns->href)) {
+      link = &ns->next;
+      continue;
+    }
+    // Repoint the subtree's references to the parent's declaration.
+    cur = copy;
+    while (cur != NULL) {
+      if (cur->type == XML_ELEMENT_NODE) {
+        xmlAttrPtr attr;
+        if (cur->ns == ns)
+          cur->ns = in_scope;
+        for (attr = cur->properties; attr != NULL; attr = attr->next) {
+          if (attr->ns == ns)
+            attr->ns = in_scope;
+        }
+        if (cur->children != NULL) {
+          cur = cur->children;
+          continue;
+        }
+      }
+      while (cur != copy && cur->next == NULL)
+        cur = cur->parent;
+      if (cur == copy)
+        break;
+      cur = cur->next;
+    }
+    *link = ns->next;
+    ns->next = NULL;
+    xmlFreeNs(ns);
+  }
+}
+
+// Copies the output saved in `entry` to the current output position.
+static void memo_splice(xsltTransformContextPtr ctxt, MemoEntry *entry) {
+  xmlNodePtr insert = ctxt->insert;
+  xmlNodePtr cached;
+
+  if (entry->lead != NULL) {
+    xmlNodePtr last = insert->last;
+    if (last != NULL && last->type == XML_TEXT_NODE &&
+        last->name == entry->lead_name) {
+      memo_add_text(ctxt, last, entry->lead);
+    } else {
+      xmlNodePtr text = xmlNewDocText(insert->doc, entry->lead);
+      if (text == NULL) {
+        ctxt->state = XSLT_STATE_STOPPED;
+        return;
+      }
+      text->name = entry->lead_name;
+      memo_link(insert, text);
+    }
+  }
+  for (cached = entry->nodes->children; cached != NULL;
+       cached = cached->next) {
+    xmlNodePtr copy = xmlDocCopyNode(cached, insert->doc, 1);
+    if (copy == NULL) {
+      ctxt->state = XSLT_STATE_STOPPED;
+      return;
+    }
+    memo_link(insert, copy);
+    if (copy->type == XML_ELEMENT_NODE)
+      memo_drop_copied_ns(insert, copy, cached->extra);
+  }
+  // Let libxslt append following text to a trailing text node, as it would
+  // have if the template had executed.
+  if (insert->last != NULL && insert->last->type == XML_TEXT_NODE &&
+      insert->last->content != ctxt->lasttext) {
+    ctxt->lasttext = insert->last->content;
+    ctxt->lasttsize = ctxt->lasttuse = xmlStrlen(insert->last->content);
+  }
+}
+
+// A hash of the attributes and namespace declarations of the output element
+// `insert`, to find instantiations that add to them.
+static unsigned long memo_insert_signature(xmlNodePtr insert) {
+  unsigned long hash = 5381;
+  xmlAttrPtr attr;
+  xmlNsPtr ns;
+  const xmlChar *p;
+
+  if (insert == NULL || insert->type != XML_ELEMENT_NODE)
+    return 0;
+  for (attr = insert->properties; attr != NULL; attr = attr->next) {
+    hash = hash * 33 + (unsigned long)(uintptr_t)attr;
+    if (attr->children != NULL && attr->children->content != NULL) {
+      for (p = attr->children->content; *p != '\0'; p++)
+        hash = hash * 33 + *p;
+    }
+  }
+  for (ns = insert->nsDef; ns != NULL; ns = ns->next)
+    hash = hash * 33 + (unsigned long)(uintptr_t)ns;
+  return hash;
+}
+
+// The length of the output text node `text`.
+static int memo_text_len(xsltTransformContextPtr ctxt, xmlNodePtr text) {
+  // libxslt keeps the length of the text node it's appending to.
+  if (ctxt->lasttext == text->content)
+    return ctxt->lasttuse;
+  return xmlStrlen(text->content);
+}
+
+// Saves the output of an instantiation, which starts after `last` (or at the
+// start of the output element) and `lead_len` bytes into `last` if it's a
+// text node.
+static MemoEntry *memo_save(MemoRun *run, xsltTransformContextPtr ctxt,
+                            xmlNodePtr last, int lead_len, MemoFrame *frame) {
+  XsltPolyfillMemo *memo = run->memo;
+  xmlNodePtr insert = ctxt->insert;
+  xmlNodePtr cur;
+  MemoEntry *entry = (MemoEntry *)xmlMalloc(sizeof(MemoEntry));
+  int i;
+
+  if (entry == NULL)
+    return NULL;
+  memset(entry, 0, sizeof(MemoEntry));
+  entry->refs = 1;
+  entry->generation = memo->generation;
+  entry->reads = frame->reads;
+  frame->reads = NULL;
+  entry->values =
+      (const xmlChar **)xmlMalloc((memo->num_params + 1) * sizeof(xmlChar *));
+  entry->nodes = xmlNewDocNode(memo->doc, NULL, (const xmlChar *)"memo", NULL);
+  if (entry->values == NULL || entry->nodes == NULL) {
+    memo_release_entry(entry, NULL);
+    return NULL;
+  }
+  for (i = 0; i < memo->num_params; i++)
+    entry->values[i] = run->values[i];
+
+  if (last != NULL && last->type == XML_TEXT_NODE &&
+      memo_text_len(ctxt, last) > lead_len) {
+    entry->lead = xmlStrdup(last->content + lead_len);
+    entry->lead_name = last->name;
+  }
+  for (cur = last != NULL ? last->next : insert->children; cur != NULL;
+       cur = cur->next) {
+    xmlNodePtr copy = xmlDocCopyNode(cur, memo->doc, 1);
+    xmlNsPtr ns;
+    if (copy == NULL) {
+      memo_release_entry(entry, NULL);
+      return NULL;
+    }
+    if (cur->type == XML_ELEMENT_NODE) {
+      for (ns = cur->nsDef; ns != NULL; ns = ns->next)
+        copy->extra++;
+    }
+    memo_link(entry->nodes, copy);
+  }
+  entry->children = frame->children;
+  entry->num_children = frame->num_children;
+  frame->children = NULL;
+  frame->num_children = 0;
+  return entry;
+}
+
+// The implementation of <memo:template>: instantiates the template body it
+// wraps, or copies in the output saved from an earlier run.
+static void memo_template(xsltTransformContextPtr ctxt, xmlNodePtr node,
+                          xmlNodePtr inst, xsltElemPreCompPtr comp) {
+  MemoRun *run = (MemoRun *)ctxt->_private;
+  XsltPolyfillMemo *memo;
+  xmlNodePtr insert = ctxt->insert;
+  MemoEntry *entry = NULL;
+  MemoFrame *frame, *parent;
+  xmlChar *key = NULL;
+  xmlNodePtr last;
+  unsigned long signature;
+  int lead_len = 0, i;
+  (void)comp;
+
+  if (run == NULL || insert == NULL) {
+    xsltApplyOneTemplate(ctxt, node, inst->children, ctxt->templ, NULL);
+    return;
+  }
+  memo = run->memo;
+  parent = run->depth > 0 ? &run->frames[run->depth - 1] : NULL;
+
+  if (memo_key(run, ctxt, node, inst)) {
+    entry = xmlHashLookup(memo->entries, xmlBufferContent(run->key));
+    for (i = 0; entry != NULL && i < memo->num_params; i++) {
+      if (entry->reads[i] && entry->values[i] != run->values[i])
+        entry = NULL;
+    }
+    if (entry != NULL) {
+      memo_splice(ctxt, entry);
+      memo_mark_live(memo, entry);
+      if (parent != NULL) {
+        memo_merge_reads(run, parent->reads, entry->reads);
+        entry->refs++;
+        memo_add_child(parent, entry);
+      }
+      memo->reused++;
+      return;
+    }
+    // Nested instantiations reuse run->key.
+    key = xmlStrdup(xmlBufferContent(run->key));
+  }
+
+  if (run->depth == run->max_depth) {
+    int max = run->max_depth ? run->max_depth * 2 : 16;
+    MemoFrame *frames =
+        (MemoFrame *)xmlRealloc(run->frames, max * sizeof(MemoFrame));
+    if (frames == NULL) {
+      xmlFree(key);
+      ctxt->state = XSLT_STATE_STOPPED;
+      return;
+    }
+    run->frames = frames;
+    run->max_depth = max;
+  }
+  frame = &run->frames[run->depth];
+  memset(frame, 0, sizeof(MemoFrame));
+  frame->reads = (unsigned char *)xmlMalloc(memo->num_params + 1);
+  if (frame->reads == NULL) {
+    xmlFree(key);
+    ctxt->state = XSLT_STATE_STOPPED;
+    return;
+  }
+  memset(frame->reads, 0, memo->num_params + 1);
+  run->depth++;
+
+  last = insert->last;
+  if (last != NULL && last->type == XML_TEXT_NODE)
+    lead_len = memo_text_len(ctxt, last);
+  signature = memo_insert_signature(insert);
+  xsltApplyOneTemplate(ctxt, node, inst->children, ctxt->templ, NULL);
+  memo->executed++;
+
+  // The frames may have been reallocated by nested instantiations.
+  run->depth--;
+  frame = &run->frames[run->depth];
+  parent = run->depth > 0 ? &run->frames[run->depth - 1] : NULL;
+  if (parent != NULL)
+    memo_merge_reads(run, parent->reads, frame->reads);
+
+  // Instantiations that add attributes or namespaces to the output element
+  // aren't saved, since splicing only adds children.
+  if (key != NULL && ctxt->state == XSLT_STATE_OK &&
+      memo_insert_signature(insert) == signature)
+    entry = memo_save(run, ctxt, last, lead_len, frame);
+  if (entry != NULL && xmlHashUpdateEntry(memo->entries, key, entry,
+                                          memo_release_entry) != 0) {
+    memo_release_entry(entry, NULL);
+    entry = NULL;
+  }
+  if (entry != NULL && parent != NULL) {
+    entry->refs++;
+    memo_add_child(parent, entry);
+  } else if (parent != NULL) {
+    // Keep the nested entries alive through the parent instead.
+    for (i = 0; i < frame->num_children; i++)
+      memo_add_child(parent, frame->children[i]);
+    frame->num_children = 0;
+  }
+  xmlFree(key);
+  for (i = 0; i < frame->num_children; i++)
+    memo_release_entry(frame->children[i], NULL);
+  xmlFree(frame->children);
+  xmlFree(frame->reads);
+}
+
+static void memo_prune_entry(void *payload, void *data, const xmlChar *name) {
+  XsltPolyfillMemo *memo = (XsltPolyfillMemo *)data;
+  if (((MemoEntry *)payload)->generation != memo->generation)
+    xmlHashRemoveEntry(memo->entries, name, memo_release_entry);
+}
+
+// Starts a memoized run of the transformation `ctxt`. Returns 0 on success.
+static int memo_begin_run(MemoRun *run, XsltPolyfillMemo *memo,
+                          xsltTransformContextPtr ctxt, xmlDocPtr source,
+                          const char **params) {
+  int i;
+
+  memset(run, 0, sizeof(MemoRun));
+  run->memo = memo;
+  run->source = source;
+  run->style = ctxt->style;
+  memo->generation++;
+  memo->reused = 0;
+  memo->executed = 0;
+
+  // Saved instantiations didn't record reads of parameters that weren't
+  // passed yet, so start over when a new one is.
+  for (i = 0; params != NULL && params[i] != NULL && params[i + 1] != NULL;
+       i += 2) {
+    if (xmlHashLookup(memo->params, (const xmlChar *)params[i]) == NULL) {
+      if (xmlHashSize(memo->entries) > 0)
+        memo_clear(memo);
+      break;
+    }
+  }
+  for (i = 0; params != NULL && params[i] != NULL && params[i + 1] != NULL;
+       i += 2) {
+    if (xmlHashLookup(memo->params, (const xmlChar *)params[i]) == NULL) {
+      memo->num_params++;
+      if (xmlHashAddEntry(memo->params, (const xmlChar *)params[i],
+                          (void *)(ptrdiff_t)memo->num_params) != 0)
+        return -1;
+    }
+  }
+
+  run->values =
+      (const xmlChar **)xmlMalloc((memo->num_params + 1) * sizeof(xmlChar *));
+  run->all = (unsigned char *)xmlMalloc(memo->num_params + 1);
+  run->globals = xmlHashCreate(16);
+  run->key = xmlBufferCreateSize(256);
+  if (run->values == NULL || run->all == NULL || run->globals == NULL ||
+      run->key == NULL)
+    return -1;
+  memset(run->values, 0, (memo->num_params + 1) * sizeof(xmlChar *));
+  memset(run->all, 1, memo->num_params + 1);
+  for (i = 0; params != NULL && params[i] != NULL && params[i + 1] != NULL;
+       i += 2) {
+    ptrdiff_t index =
+        (ptrdiff_t)xmlHashLookup(memo->params, (const xmlChar *)params[i]);
+    run->values[index - 1] =
+        xmlDictLookup(memo->dict, (const xmlChar *)params[i + 1], -1);
+  }
+
+  // Number the source elements, which memo_add_node_id() relies on.
+  xmlXPathOrderDocElems(source);
+  ctxt->_private = run;
+  xmlXPathRegisterVariableLookup(ctxt->xpathCtxt, memo_variable_lookup, ctxt);
+  return 0;
+}
+
+// Finishes a memoized run, dropping the saved instantiations it didn't use,
+// or all of them if it failed.
+static void memo_end_run(MemoRun *run, int succeeded) {
+  XsltPolyfillMemo *memo = run->memo;
+  if (memo == NULL)
+    return;
+  if (succeeded)
+    xmlHashScan(memo->entries, memo_prune_entry, memo);
+  else
+    memo_clear(memo);
+  xmlFree(run->values);
+  xmlFree(run->all);
+  xmlHashFree(run->globals, memo_free_deps);
+  if (run->key)
+    xmlBufferFree(run->key);
+  xmlFree(run->frames);
+}
+
 /**
  * @brief A callback function for libxslt to load external documents.
  *
  * This function is called by libxslt when it encounters an <xsl:import>
  * or <xsl:include> element. It uses the fetch_and_load_document JS function
  * to get the content from the URL and then parses it into an xmlDocPtr.
+ * Native builds hand other loads to libxslt's built-in loader instead.
  *
  * @param URI The URI of the document to load.
  * @param dict A dictionary for interning strings (not used).
  * @param options Parser options.
- * @param ctxt The transformation context (not used).
+ * @param ctxt The transformation context for documents, or the including
+ * stylesheet for stylesheets.
  * @param type The type of load (document or stylesheet).
  * @return An xmlDocPtr for the loaded document, or NULL on failure.
  */
 static xmlDocPtr docLoader(const xmlChar *URI, xmlDictPtr dict, int options,
                            void *ctxt, xsltLoadType type) {
-  const char *url = (const char *)URI;
-
   // Check if this is the stylesheet itself (for document('')).
   // This avoids a redundant fetch and potential Asyncify suspension issues.
   // ctxt is only a transform context for XSLT_LOAD_DOCUMENT.
@@ -399,6 +1641,10 @@ static xmlDocPtr docLoader(const xmlChar *URI, xmlDictPtr dict, int options,
     }
   }
 
+#ifndef __EMSCRIPTEN__
+  xmlDocPtr doc = native_default_loader(URI, dict, options, ctxt, type);
+#else
+  const char *url = (const char *)URI;
   printf("Loading external document from URL %s...\n", url);
   const char *content = fetch_and_load_document(url);
   printf("Done loading %s.\n", url);
@@ -412,6 +1658,13 @@ static xmlDocPtr docLoader(const xmlChar *URI, xmlDictPtr dict, int options,
     printf("XSLT Transformation Error: Failed to parse included document.\n");
   }
   free((void *)content); // The content was allocated by stringToNewUTF8.
+#endif
+
+  // Included and imported modules of a memoized stylesheet are memoized too.
+  // ctxt is the including or importing stylesheet for XSLT_LOAD_STYLESHEET.
+  if (doc != NULL && type == XSLT_LOAD_STYLESHEET &&
+      memo_stylesheet_rewritten((xsltStylesheetPtr)ctxt))
+    memo_rewrite_stylesheet(doc);
 
   return doc;
 }
@@ -524,62 +1777,66 @@ static void adjust_html_encoding_meta(xmlDocPtr doc, xsltStylesheetPtr style) {
 }
 
 /**
- * @brief Transforms an XML string using an XSLT string.
- *
- * This function is exposed to JavaScript. It takes XML and XSLT content as
- * strings, performs the transformation, and returns the result as a string. It
- * also accepts an array of strings for XSLT parameters.
- *
- * IMPORTANT: The returned string is allocated in the WASM module's memory
- * and must be freed from the JavaScript side by calling `_free()`.
+ * @brief Performs the process-wide libxml2/libxslt setup for transformations.
  *
- * @param xml_content A string containing the source XML document.
- * @param xslt_content A string containing the XSLT stylesheet.
- * @param params An array of key-value pairs for XSLT parameters, terminated by
- * NULL. Example: ["param1", "'value1'", "param2", "'value2'", NULL]
- * @param out_mime_type A pointer to a buffer (at least 32 bytes) where the
- * output MIME type will be written.
- * @return A pointer to a new string containing the transformed document, or
- * NULL on error.
+ * This must be called before xslt_polyfill_parse_stylesheet(). Native
+ * multithreaded callers must call it once, before starting any threads.
  */
-EMSCRIPTEN_KEEPALIVE
-char *transform(const char *xml_content, int xml_len, const char *xslt_content,
-                int xslt_len, const char **params, const char *xslt_url,
-                char *out_mime_type) {
-  xmlDocPtr xml_doc = NULL;
-  xmlDocPtr xslt_doc = NULL;
-  xsltStylesheetPtr xslt_sheet = NULL;
-  xmlDocPtr result_doc = NULL;
-  xsltTransformContextPtr ctxt = NULL;
-  xsltSecurityPrefsPtr sec_prefs = NULL;
-  char *result_string = NULL;
-
+void xslt_polyfill_init(void) {
   // Initialize the XML library. This is important for thread safety.
   xmlInitParser();
 
-  // Clear JS string cache used for sorting
-  void clear_collate_cache();
-  clear_collate_cache();
-
   // Enable EXSLT functions.
   exsltRegisterAll();
 
   // Set our custom document loader.
+#ifndef __EMSCRIPTEN__
+  if (xsltDocDefaultLoader != docLoader)
+    native_default_loader = xsltDocDefaultLoader;
+  if (xmlGetExternalEntityLoader() != native_policy_entity_loader) {
+    native_entity_loader = xmlGetExternalEntityLoader();
+    xmlSetExternalEntityLoader(native_policy_entity_loader);
+  }
+#endif
   xsltSetLoaderFunc(docLoader);
 
-  // Parse the input strings into libxml2 documents using their known length.
-  xml_doc = xmlReadMemory(xml_content, xml_len, "xml", "UTF-8", XML_PARSE_HUGE);
-  if (xml_doc == NULL) {
-    printf("XSLT Transformation Error: Failed to parse XML document.\n");
-    goto cleanup;
-  }
+  // The element memoized stylesheets wrap template bodies in.
+  xsltRegisterExtModuleElement((const xmlChar *)"template", MEMO_NS, NULL,
+                               memo_template);
+
+  // Double the number of max variables xslt uses internally.
+  xsltMaxVars = 20000;
+}
+
+/**
+ * @brief Parses and compiles an XSLT stylesheet.
+ *
+ * The returned stylesheet is not modified by xslt_polyfill_apply_stylesheet(),
+ * so it can be shared between threads in native builds.
+ *
+ * @param xslt_content The XSLT stylesheet bytes.
+ * @param xslt_len The length of `xslt_content`.
+ * @param xslt_url The base URL used to resolve includes and document() calls.
+ * @param memoize If nonzero, prepare the stylesheet for use with an
+ * XsltPolyfillMemo.
+ * @return The compiled stylesheet, to be freed with xsltFreeStylesheet(), or
+ * NULL on error.
+ */
+xsltStylesheetPtr xslt_polyfill_parse_stylesheet(const char *xslt_content,
+                                                 int xslt_len,
+                                                 const char *xslt_url,
+                                                 int memoize) {
+  xmlDocPtr xslt_doc = NULL;
+  xsltStylesheetPtr xslt_sheet = NULL;
 
   xslt_doc = xmlReadMemory(xslt_content, xslt_len, xslt_url, "UTF-8",
                            XSLT_PARSE_OPTIONS | XML_PARSE_HUGE);
   if (xslt_doc == NULL) {
     printf("XSLT Transformation Error: Failed to parse XSLT document.\n");
-    goto cleanup;
+    return NULL;
   }
+  if (memoize)
+    memo_rewrite_stylesheet(xslt_doc);
 
   xslt_sheet = xsltParseStylesheetDoc(xslt_doc);
   if (xslt_sheet == NULL) {
@@ -588,17 +1845,47 @@ char *transform(const char *xml_content, int xml_len, const char *xslt_content,
     xmlFreeDoc(xslt_doc);
     printf("XSLT Transformation Error: Failed to parse XSLT stylesheet from "
            "document.\n");
-    goto cleanup;
+    return NULL;
   }
   // No need to free xslt_doc separately from here on, it's owned by xslt_sheet.
 
-  // 1. Omit the XML declaration (e.g., <?xml version="1.0"?>) from the output.
+  // Omit the XML declaration (e.g., <?xml version="1.0"?>) from the output.
   xslt_sheet->omitXmlDeclaration = 1;
 
-  // 2. Double the number of max variables xslt uses internally.
-  xsltMaxVars = 20000;
+  return xslt_sheet;
+}
+
+/**
+ * @brief Applies a compiled stylesheet to a parsed source document.
+ *
+ * Each call uses its own transformation context, so concurrent calls sharing
+ * one stylesheet are safe in native builds with a threaded libxml2/libxslt.
+ *
+ * @param xslt_sheet The stylesheet from xslt_polyfill_parse_stylesheet().
+ * @param xml_doc The source document.
+ * @param params An array of key-value pairs for XSLT parameters, terminated by
+ * NULL. Values are treated as literal strings.
+ * @param out_mime_type A pointer to a buffer (at least 32 bytes) where the
+ * output MIME type will be written.
+ * @param memo If not NULL, output saved in `memo` by earlier transformations
+ * is reused where possible, and output from this one is saved. The stylesheet
+ * must have been parsed with `memoize` set.
+ * @return The result document, to be freed with xmlFreeDoc() unless it is
+ * `xml_doc` itself, or NULL on error.
+ */
+xmlDocPtr xslt_polyfill_apply_stylesheet(xsltStylesheetPtr xslt_sheet,
+                                         xmlDocPtr xml_doc,
+                                         const char **params,
+                                         char *out_mime_type,
+                                         XsltPolyfillMemo *memo) {
+  xmlDocPtr result_doc = NULL;
+  xsltTransformContextPtr ctxt = NULL;
+  xsltSecurityPrefsPtr sec_prefs = NULL;
+  MemoRun memo_run;
+
+  memo_run.memo = NULL;
 
-  // 3. Create a new transformation context.
+  // 1. Create a new transformation context.
   ctxt = xsltNewTransformContext(xslt_sheet, xml_doc);
   if (ctxt == NULL) {
     printf("XSLT Transformation Error: Failed to create XSLT transformation "
@@ -609,7 +1896,7 @@ char *transform(const char *xml_content, int xml_len, const char *xslt_content,
   // Use our custom sort function that matches Chrome's behavior.
   xsltSetCtxtSortFunc(ctxt, xslt_polyfill_sort_function);
 
-  // 4. Set up security preferences to disable file and network access.
+  // 2. Set up security preferences to disable file and network access.
   sec_prefs = xsltNewSecurityPrefs();
   if (sec_prefs == NULL) {
     printf("XSLT Transformation Error: Failed to create XSLT security "
@@ -621,9 +1908,19 @@ char *transform(const char *xml_content, int xml_len, const char *xslt_content,
                        xsltSecurityForbid);
   xsltSetSecurityPrefs(sec_prefs, XSLT_SECPREF_WRITE_NETWORK,
                        xsltSecurityForbid);
+#ifdef __EMSCRIPTEN__
   // We don't forbid reading files or from the network, because our custom
   // loader needs to be able to do that. The security is handled by the
   // browser's same-origin policy in fetch().
+#else
+  // There's no same-origin policy natively, so apply the read policy from
+  // xslt_polyfill_set_read_policy() instead.
+  xsltSetSecurityPrefs(sec_prefs, XSLT_SECPREF_READ_FILE,
+                       native_check_read_file);
+  xsltSetSecurityPrefs(sec_prefs, XSLT_SECPREF_READ_NETWORK,
+                       native_allow_network ? xsltSecurityAllow
+                                            : xsltSecurityForbid);
+#endif
 
   if (xsltSetCtxtSecurityPrefs(sec_prefs, ctxt) != 0) {
     printf("XSLT Transformation Error: Failed to set security preferences on "
@@ -631,7 +1928,7 @@ char *transform(const char *xml_content, int xml_len, const char *xslt_content,
     goto cleanup;
   }
 
-  // 5. Apply the transformation using the configured context and parameters.
+  // 3. Apply the transformation using the configured context and parameters.
   // xsltQuoteUserParams treats values as literal strings rather than XPath
   // expressions, so values containing single quotes are handled correctly.
   if (params != NULL) {
@@ -640,6 +1937,11 @@ char *transform(const char *xml_content, int xml_len, const char *xslt_content,
       goto cleanup;
     }
   }
+  if (memo != NULL &&
+      memo_begin_run(&memo_run, memo, ctxt, xml_doc, params) != 0) {
+    printf("XSLT Transformation Error: Failed to set up memoization.\n");
+    goto cleanup;
+  }
   result_doc = xsltApplyStylesheetUser(xslt_sheet, xml_doc,
                                        NULL, NULL, NULL, ctxt);
   if (result_doc == NULL) {
@@ -653,10 +1955,76 @@ char *transform(const char *xml_content, int xml_len, const char *xslt_content,
   strncpy(out_mime_type, mime, 32);
   out_mime_type[31] = '\0';
 
-  // 6. Ensure the HTML meta tag for encoding is in the Chrome/Blink format.
+  // 4. Ensure the HTML meta tag for encoding is in the Chrome/Blink format.
   adjust_html_encoding_meta(result_doc, xslt_sheet);
 
-  // 7. Serialize the result document to a string.
+cleanup:
+  memo_end_run(&memo_run, result_doc != NULL);
+  if (sec_prefs)
+    xsltFreeSecurityPrefs(sec_prefs);
+  if (ctxt)
+    xsltFreeTransformContext(ctxt);
+
+  return result_doc;
+}
+
+#ifdef __EMSCRIPTEN__
+/**
+ * @brief Transforms an XML string using an XSLT string.
+ *
+ * This function is exposed to JavaScript. It takes XML and XSLT content as
+ * strings, performs the transformation, and returns the result as a string. It
+ * also accepts an array of strings for XSLT parameters.
+ *
+ * IMPORTANT: The returned string is allocated in the WASM module's memory
+ * and must be freed from the JavaScript side by calling `_free()`.
+ *
+ * @param xml_content A string containing the source XML document.
+ * @param xslt_content A string containing the XSLT stylesheet.
+ * @param params An array of key-value pairs for XSLT parameters, terminated by
+ * NULL. Example: ["param1", "'value1'", "param2", "'value2'", NULL]
+ * @param out_mime_type A pointer to a buffer (at least 32 bytes) where the
+ * output MIME type will be written.
+ * @param memo If not NULL, the XsltPolyfillMemo from xslt_polyfill_memo_new()
+ * used to reuse output between transformations of the same document.
+ * @return A pointer to a new string containing the transformed document, or
+ * NULL on error.
+ */
+EMSCRIPTEN_KEEPALIVE
+char *transform(const char *xml_content, int xml_len, const char *xslt_content,
+                int xslt_len, const char **params, const char *xslt_url,
+                char *out_mime_type, XsltPolyfillMemo *memo) {
+  xmlDocPtr xml_doc = NULL;
+  xsltStylesheetPtr xslt_sheet = NULL;
+  xmlDocPtr result_doc = NULL;
+  char *result_string = NULL;
+
+  xslt_polyfill_init();
+
+  // Clear JS string cache used for sorting
+  void clear_collate_cache();
+  clear_collate_cache();
+
+  // Parse the input strings into libxml2 documents using their known length.
+  xml_doc = xmlReadMemory(xml_content, xml_len, "xml", "UTF-8", XML_PARSE_HUGE);
+  if (xml_doc == NULL) {
+    printf("XSLT Transformation Error: Failed to parse XML document.\n");
+    goto cleanup;
+  }
+
+  xslt_sheet = xslt_polyfill_parse_stylesheet(xslt_content, xslt_len, xslt_url,
+                                              memo != NULL);
+  if (xslt_sheet == NULL) {
+    goto cleanup;
+  }
+
+  result_doc = xslt_polyfill_apply_stylesheet(xslt_sheet, xml_doc, params,
+                                              out_mime_type, memo);
+  if (result_doc == NULL) {
+    goto cleanup;
+  }
+
+  // Serialize the result document to a string.
   xmlChar *result_buffer = NULL;
   int result_len = 0;
   int bytes_written = xsltSaveResultToString(&result_buffer, &result_len,
@@ -684,10 +2052,6 @@ cleanup:
   // Clean up all the allocated resources in reverse order of creation.
   if (result_doc != xml_doc)
     xmlFreeDoc(result_doc); // Don't double-free if transform was identity
-  if (sec_prefs)
-    xsltFreeSecurityPrefs(sec_prefs);
-  if (ctxt)
-    xsltFreeTransformContext(ctxt);
   if (xslt_sheet)
     xsltFreeStylesheet(xslt_sheet);
   if (xml_doc)
@@ -699,3 +2063,4 @@ cleanup:
   // Return the allocated string (or NULL on failure).
   return result_string;
 }
+#endif // __EMSCRIPTEN__
@@ -0,0 +1,45 @@
+#ifndef XSLT_POLYFILL_TRANSFORM_H
+#define XSLT_POLYFILL_TRANSFORM_H
+
+#include <libxml/tree.h>
+#include <libxslt/xsltInternals.h>
+
+// The transformation steps shared by the Wasm `transform()` export and the
+// native batch transformer. See transform.c for details.
+
+void xslt_polyfill_init(void);
+
+// Output saved from the template instantiations of earlier transformations,
+// for incremental transformations of one document. Not thread-safe.
+typedef struct XsltPolyfillMemo XsltPolyfillMemo;
+
+XsltPolyfillMemo *xslt_polyfill_memo_new(void);
+void xslt_polyfill_memo_free(XsltPolyfillMemo *memo);
+int xslt_polyfill_memo_reused(const XsltPolyfillMemo *memo);
+int xslt_polyfill_memo_executed(const XsltPolyfillMemo *memo);
+
+xsltStylesheetPtr xslt_polyfill_parse_stylesheet(const char *xslt_content,
+                                                 int xslt_len,
+                                                 const char *xslt_url,
+                                                 int memoize);
+
+xmlDocPtr xslt_polyfill_apply_stylesheet(xsltStylesheetPtr xslt_sheet,
+                                         xmlDocPtr xml_doc,
+                                         const char **params,
+                                         char *out_mime_type,
+                                         XsltPolyfillMemo *memo);
+
+#ifndef __EMSCRIPTEN__
+// Frees per-thread state. Native worker threads should call this before
+// exiting.
+void xslt_polyfill_thread_cleanup(void);
+
+// Sets which external documents (includes, imports, document() and external
+// entities) native builds may read: files under `read_root`, and network URLs
+// only if `allow_network` is nonzero. Until this is called, or if `read_root`
+// is NULL, no files are read. Must be called before starting any threads.
+// Returns -1 if `read_root` can't be resolved.
+int xslt_polyfill_set_read_policy(const char *read_root, int allow_network);
+#endif
+
+#endif // XSLT_POLYFILL_TRANSFORM_H
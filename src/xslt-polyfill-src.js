@@ -25,6 +25,10 @@
   });
   window.xsltUsePolyfillAlways = 'xsltUsePolyfillAlways' in window ? window.xsltUsePolyfillAlways : false;
   window.xsltDontAutoloadXmlDocs = 'xsltDontAutoloadXmlDocs' in window ? window.xsltDontAutoloadXmlDocs : false;
+  window.xsltPolyfillResultCacheBytes =
+    'xsltPolyfillResultCacheBytes' in window ? window.xsltPolyfillResultCacheBytes : 0;
+  window.xsltPolyfillIncrementalTransforms =
+    'xsltPolyfillIncrementalTransforms' in window ? window.xsltPolyfillIncrementalTransforms : false;
   let xsltPolyfillHideRequestId = 0;
   let currentSpinnerText = null;
 
@@ -135,14 +139,22 @@
     let wasm_transform = null;
     let wasm_transform_async = null;
     let wasm_free = null;
+    let wasm_memo_new = null;
+    let wasm_memo_free = null;
 
     createXSLTTransformModule()
       .then((Module) => {
         WasmModule = Module;
-        const args = ['transform', 'number', ['number', 'number', 'number', 'number', 'number', 'number', 'number']];
+        const args = [
+          'transform',
+          'number',
+          ['number', 'number', 'number', 'number', 'number', 'number', 'number', 'number'],
+        ];
         wasm_transform = Module.cwrap(...args, { async: false });
         wasm_transform_async = Module.cwrap(...args, { async: true });
         wasm_free = Module._free;
+        wasm_memo_new = Module._xslt_polyfill_memo_new;
+        wasm_memo_free = Module._xslt_polyfill_memo_free;
 
         // Tell people we're ready.
         polyfillReadyPromiseResolve();
@@ -246,13 +258,244 @@
     const textEncoder = new TextEncoder();
     const textDecoder = new TextDecoder();
 
-    function transformXmlWithXslt(xmlContent, xsltContent, parameters, xsltUrl, allowAsync, buildPlainText) {
+    // Opt-in LRU cache of transformation results, enabled by setting
+    // `window.xsltPolyfillResultCacheBytes` to a positive byte budget. Entries
+    // are keyed by hashes of the stylesheet, source, parameters and base URL,
+    // and hold the raw serialized output and MIME type. Map iteration order is
+    // insertion order, so the first key is always the least recently used.
+    const resultCache = new Map();
+    const resultCacheStats = { hits: 0, misses: 0, bypasses: 0, evictions: 0, bytes: 0 };
+    // Whether each recently used stylesheet's results may be cached, also kept
+    // in least recently used order. It is capped at a fixed number of
+    // stylesheets, so that pages generating stylesheets dynamically don't grow
+    // it without bound.
+    const stylesheetCacheability = new Map();
+    const maxRememberedStylesheets = 64;
+
+    // A fast, non-cryptographic 53-bit hash (cyrb53) over either a string or a
+    // Uint8Array.
+    function fastHash(data) {
+      let h1 = 0xdeadbeef;
+      let h2 = 0x41c6ce57;
+      const isString = typeof data === 'string';
+      for (let i = 0; i < data.length; i++) {
+        const ch = isString ? data.charCodeAt(i) : data[i];
+        h1 = Math.imul(h1 ^ ch, 2654435761);
+        h2 = Math.imul(h2 ^ ch, 1597334677);
+      }
+      h1 = Math.imul(h1 ^ (h1 >>> 16), 2246822507) ^ Math.imul(h2 ^ (h2 >>> 13), 3266489909);
+      h2 = Math.imul(h2 ^ (h2 >>> 16), 2246822507) ^ Math.imul(h1 ^ (h1 >>> 13), 3266489909);
+      return (4294967296 * (2097151 & h2) + (h1 >>> 0)).toString(36);
+    }
+
+    function resultCacheBudget() {
+      const budget = Number(window.xsltPolyfillResultCacheBytes);
+      return Number.isFinite(budget) && budget > 0 ? budget : 0;
+    }
+
+    function stylesheetCacheKey(xsltContent) {
+      return `${fastHash(xsltContent)}.${xsltContent.length}`;
+    }
+
+    function resultCacheKey(stylesheetKey, xmlContent, parameters, xsltUrl) {
+      let params = '';
+      if (parameters && parameters.size) {
+        const entries = Array.from(parameters.entries(), ([key, value]) => [key, String(value)]);
+        entries.sort((a, b) => (a[0] < b[0] ? -1 : a[0] > b[0] ? 1 : 0));
+        params = JSON.stringify(entries);
+      }
+      return [
+        stylesheetKey,
+        `${fastHash(xmlContent)}.${xmlContent.length}`,
+        `${fastHash(params)}.${params.length}`,
+        xsltUrl,
+      ].join('|');
+    }
+
+    // EXSLT functions whose results can differ between runs on identical input.
+    const nonDeterministicExslt = [
+      // Most date functions default to the current date/time when called
+      // without arguments, so treat the whole module as non-deterministic.
+      { ns: 'http://exslt.org/dates-and-times', fn: '[\\w.-]+' },
+      { ns: 'http://exslt.org/math', fn: 'random' },
+      { ns: 'http://exslt.org/random', fn: '[\\w.-]+' },
+    ];
+
+    // Returns false if the stylesheet references any non-deterministic EXSLT
+    // function, in which case its results must never be cached.
+    function isCacheableStylesheet(xsltText) {
+      for (const { ns, fn } of nonDeterministicExslt) {
+        const escapedNs = ns.replace(/[.]/g, '\\.');
+        const prefixRe = new RegExp(`xmlns:([\\w.-]+)\\s*=\\s*(["'])${escapedNs}\\2`, 'g');
+        for (const [, prefix] of xsltText.matchAll(prefixRe)) {
+          const escapedPrefix = prefix.replace(/[.]/g, '\\.');
+          if (new RegExp(`(^|[^\\w.:-])${escapedPrefix}:${fn}\\s*\\(`).test(xsltText)) {
+            return false;
+          }
+        }
+      }
+      return true;
+    }
+
+    // Memoized isCacheableStylesheet(), keyed by stylesheetCacheKey().
+    // transformXmlWithXslt() also marks stylesheets as uncacheable once a
+    // transformation with them has fetched an external document.
+    function isCacheableStylesheetContent(stylesheetKey, xsltContent) {
+      let cacheable = stylesheetCacheability.get(stylesheetKey);
+      if (cacheable === undefined) {
+        const xsltText = xsltContent instanceof Uint8Array ? textDecoder.decode(xsltContent) : xsltContent;
+        cacheable = isCacheableStylesheet(xsltText);
+      }
+      rememberStylesheetCacheability(stylesheetKey, cacheable);
+      return cacheable;
+    }
+
+    function rememberStylesheetCacheability(stylesheetKey, cacheable) {
+      // Move to the most recently used position.
+      stylesheetCacheability.delete(stylesheetKey);
+      stylesheetCacheability.set(stylesheetKey, cacheable);
+      if (stylesheetCacheability.size > maxRememberedStylesheets) {
+        stylesheetCacheability.delete(stylesheetCacheability.keys().next().value);
+      }
+    }
+
+    // Returns the cached entry for `key`, counting a hit. Misses are counted
+    // by the caller once the transformation has run, since one that fetches
+    // documents turns out to be a bypass instead.
+    function resultCacheLookup(key) {
+      const entry = resultCache.get(key);
+      if (!entry) {
+        return null;
+      }
+      // Move to the most recently used position.
+      resultCache.delete(key);
+      resultCache.set(key, entry);
+      resultCacheStats.hits++;
+      return entry;
+    }
+
+    function resultCacheStore(key, content, mimeType) {
+      const budget = resultCacheBudget();
+      // Strings are stored as UTF-16, so two bytes per code unit.
+      const size = (content.length + mimeType.length + key.length) * 2;
+      if (size > budget) {
+        return;
+      }
+      const existing = resultCache.get(key);
+      if (existing) {
+        resultCacheStats.bytes -= existing.size;
+        resultCache.delete(key);
+      }
+      resultCache.set(key, { content, mimeType, size });
+      resultCacheStats.bytes += size;
+      trimResultCache(budget);
+    }
+
+    function trimResultCache(budget) {
+      for (const [key, entry] of resultCache) {
+        if (resultCacheStats.bytes <= budget) {
+          break;
+        }
+        resultCache.delete(key);
+        resultCacheStats.bytes -= entry.size;
+        resultCacheStats.evictions++;
+      }
+    }
+
+    function xsltPolyfillResultCacheStats() {
+      return { ...resultCacheStats, entries: resultCache.size, budget: resultCacheBudget() };
+    }
+
+    // Counters for incremental transformations, which are kept separately from
+    // the result cache: `transforms` that ran with a memo, and the template
+    // instantiations they reused from earlier runs or executed.
+    const incrementalStats = { transforms: 0, reusedInstantiations: 0, executedInstantiations: 0 };
+
+    function xsltPolyfillIncrementalStats() {
+      return { ...incrementalStats };
+    }
+
+    // Whether a stylesheet's template output can be memoized between runs:
+    // everything it depends on has to be part of the memo key. Generated ids
+    // and documents loaded by document() aren't.
+    function isMemoizableStylesheet(stylesheetText) {
+      return (
+        isCacheableStylesheetContent(stylesheetCacheKey(stylesheetText), stylesheetText) &&
+        !/(^|[^\w.:-])(generate-id|document)\s*\(/.test(stylesheetText)
+      );
+    }
+
+    // Frees the memos of XSLTProcessors that are garbage collected.
+    const memoRegistry = new FinalizationRegistry((ptr) => wasm_memo_free(ptr));
+
+    function xsltPolyfillClearResultCache() {
+      resultCache.clear();
+      stylesheetCacheability.clear();
+      Object.keys(resultCacheStats).forEach((stat) => (resultCacheStats[stat] = 0));
+    }
+
+    // Wraps plain text output in a minimal XHTML document, if requested.
+    function buildTransformResult(content, mimeType, buildPlainText) {
+      if (buildPlainText && mimeType === 'text/plain') {
+        content = content.replace(/&/g, '&amp;').replace(/</g, '&lt;').replace(/>/g, '&gt;');
+        content = `<html xmlns="http://www.w3.org/1999/xhtml">\n<head><title></title></head>\n<body>\n<pre>${content}</pre>\n</body>\n</html>`;
+        mimeType = 'application/xml';
+      }
+      return { content, mimeType };
+    }
+
+    // `memo` is a Wasm XsltPolyfillMemo pointer for incremental
+    // transformations (see XSLTProcessor), or 0. When the transformation runs
+    // with a memo, the result also reports whether the memo may be used again
+    // (`memoUsable`), which it may not once the stylesheet fetched documents.
+    function transformXmlWithXslt(xmlContent, xsltContent, parameters, xsltUrl, allowAsync, buildPlainText, memo) {
       if (!wasm_transform || !WasmModule) {
         throw new Error(
           `Polyfill XSLT Wasm module not yet loaded. Please wait for the ${promiseName} promise to resolve.`,
         );
       }
 
+      // Serve repeated transformations from the result cache, if enabled.
+      const cacheBudget = resultCacheBudget();
+      let stylesheetKey = null;
+      let cacheKey = null;
+      if (cacheBudget || memo) {
+        stylesheetKey = stylesheetCacheKey(xsltContent);
+        const cacheable = isCacheableStylesheetContent(stylesheetKey, xsltContent);
+        if (cacheBudget && cacheable) {
+          cacheKey = resultCacheKey(stylesheetKey, xmlContent, parameters, xsltUrl);
+          const cached = resultCacheLookup(cacheKey);
+          if (cached) {
+            return buildTransformResult(cached.content, cached.mimeType, buildPlainText);
+          }
+        } else if (cacheBudget) {
+          resultCacheStats.bypasses++;
+        }
+      }
+      // Documents fetched during the transformation (document() calls and
+      // <xsl:include>) are not part of the cache key, so results that depend
+      // on them are not stored.
+      const externalLoadsBefore = WasmModule.externalLoadCount || 0;
+      let outcomeRecorded = false;
+      // Counts a transformation that missed the cache as a miss, or as a
+      // bypass if it fetched documents, exactly once, whether it finished or
+      // threw. Returns whether its output may be stored.
+      const recordCacheOutcome = () => {
+        const deterministic = (WasmModule.externalLoadCount || 0) === externalLoadsBefore;
+        if (!outcomeRecorded) {
+          outcomeRecorded = true;
+          if (!deterministic && stylesheetKey !== null) {
+            rememberStylesheetCacheability(stylesheetKey, false);
+          }
+          if (cacheKey && deterministic) {
+            resultCacheStats.misses++;
+          } else if (cacheKey) {
+            resultCacheStats.bypasses++;
+          }
+        }
+        return deterministic;
+      };
+
       let xmlPtr = 0;
       let xsltPtr = 0;
       let paramsPtr = 0;
@@ -357,6 +600,7 @@
           paramsPtr,
           xsltUrlPtr,
           mimeTypePtr,
+          memo,
         );
 
         if (!allowAsync && WasmModule.Asyncify && WasmModule.Asyncify.state === 1 /* Suspending */) {
@@ -371,38 +615,50 @@
 
         const finishProcessing = (resultPtr) => {
           // 5. Convert the result pointers (char*) back to JS strings.
-          let resultString = readStringFromHeap(resultPtr);
-          let mimeTypeString = readStringFromHeap(mimeTypePtr);
+          const resultString = readStringFromHeap(resultPtr);
+          const mimeTypeString = readStringFromHeap(mimeTypePtr);
 
           // 6. Free the result pointer itself, which was allocated by the C code.
           wasm_free(resultPtr);
 
-          // 7. Handle the plain text case, if needed.
-          if (buildPlainText && mimeTypeString === 'text/plain') {
-            resultString = resultString.replace(/&/g, '&amp;').replace(/</g, '&lt;').replace(/>/g, '&gt;');
-            resultString = `<html xmlns="http://www.w3.org/1999/xhtml">\n<head><title></title></head>\n<body>\n<pre>${resultString}</pre>\n</body>\n</html>`;
-            mimeTypeString = 'application/xml';
+          // 7. Store the raw output in the result cache, if it is cacheable.
+          const deterministic = recordCacheOutcome();
+          if (cacheKey && deterministic) {
+            resultCacheStore(cacheKey, resultString, mimeTypeString);
           }
 
-          return {
-            content: resultString,
-            mimeType: mimeTypeString,
-          };
+          // 8. Handle the plain text case, if needed.
+          const result = buildTransformResult(resultString, mimeTypeString, buildPlainText);
+          if (memo) {
+            incrementalStats.transforms++;
+            incrementalStats.reusedInstantiations += WasmModule._xslt_polyfill_memo_reused(memo);
+            incrementalStats.executedInstantiations += WasmModule._xslt_polyfill_memo_executed(memo);
+            result.memoUsable = deterministic;
+          }
+          return result;
         };
 
         if (resultPtr_or_Promise instanceof Promise) {
           // Return a Promise that resolves to the finished object
-          return resultPtr_or_Promise.then((resultPtr) => {
-            const res = finishProcessing(resultPtr);
-            cleanup();
-            return res;
-          });
+          return resultPtr_or_Promise.then(
+            (resultPtr) => {
+              const res = finishProcessing(resultPtr);
+              cleanup();
+              return res;
+            },
+            (e) => {
+              recordCacheOutcome();
+              cleanup();
+              throw e;
+            },
+          );
         }
         // Not a promise - just return the finished object.
         const res = finishProcessing(resultPtr_or_Promise);
         cleanup();
         return res;
       } catch (e) {
+        recordCacheOutcome();
         cleanup();
         throw e;
       }
@@ -458,6 +714,10 @@
       #stylesheetText = null;
       #parameters = new Map();
       #stylesheetBaseUrl = null;
+      // The memo for incremental transformations of `sourceXml`, and whether
+      // the stylesheet can't use one.
+      #memo = null;
+      #memoUnsupported = false;
 
       constructor() {}
       isPolyfill() {
@@ -467,6 +727,69 @@
       importStylesheet(stylesheet) {
         this.#stylesheetText = new XMLSerializer().serializeToString(stylesheet);
         this.#stylesheetBaseUrl = stylesheet.baseURI || window.location.href;
+        this.#freeMemo();
+        this.#memoUnsupported = false;
+      }
+
+      // Returns the memo to transform `sourceXml` with in incremental mode, or
+      // 0. Each memo only holds output for one source document.
+      #memoFor(sourceXml) {
+        if (!window.xsltPolyfillIncrementalTransforms || this.#memoUnsupported) {
+          this.#freeMemo();
+          return 0;
+        }
+        if (this.#memo && this.#memo.sourceXml === sourceXml) {
+          return this.#memo.ptr;
+        }
+        this.#freeMemo();
+        if (!isMemoizableStylesheet(this.#stylesheetText)) {
+          this.#memoUnsupported = true;
+          return 0;
+        }
+        const ptr = wasm_memo_new();
+        if (!ptr) {
+          return 0;
+        }
+        this.#memo = { ptr, sourceXml };
+        memoRegistry.register(this, ptr, this.#memo);
+        return ptr;
+      }
+
+      #freeMemo() {
+        if (this.#memo) {
+          memoRegistry.unregister(this.#memo);
+          wasm_memo_free(this.#memo.ptr);
+          this.#memo = null;
+        }
+      }
+
+      // Runs the transformation. In incremental mode, template output saved
+      // from earlier runs on the same source is reused where the parameters
+      // it depends on haven't changed.
+      #transform(source, buildPlainText) {
+        const sourceXml = new XMLSerializer().serializeToString(source);
+        const memo = this.#memoFor(sourceXml);
+        let result;
+        try {
+          result = transformXmlWithXslt(
+            sourceXml,
+            this.#stylesheetText,
+            this.#parameters,
+            this.#stylesheetBaseUrl,
+            /*allowAsync*/ false,
+            buildPlainText,
+            memo,
+          );
+        } catch (e) {
+          this.#freeMemo();
+          throw e;
+        }
+        // Output that depends on fetched documents can't be memoized.
+        if (memo && result.memoUsable === false) {
+          this.#freeMemo();
+          this.#memoUnsupported = true;
+        }
+        return result;
       }
 
       // Returns a new document (XML or HTML).
@@ -477,15 +800,7 @@
         if (isEmptySourceDocument(source)) {
           return null;
         }
-        const sourceXml = new XMLSerializer().serializeToString(source);
-        const { content, mimeType } = transformXmlWithXslt(
-          sourceXml,
-          this.#stylesheetText,
-          this.#parameters,
-          this.#stylesheetBaseUrl,
-          /*allowAsync*/ false,
-          /*buildPlainText*/ true,
-        );
+        const { content, mimeType } = this.#transform(source, /*buildPlainText*/ true);
         return new DOMParser().parseFromString(content, mimeType);
       }
 
@@ -498,15 +813,7 @@
         if (isEmptySourceDocument(source)) {
           return null;
         }
-        const sourceXml = new XMLSerializer().serializeToString(source);
-        const { content, mimeType } = transformXmlWithXslt(
-          sourceXml,
-          this.#stylesheetText,
-          this.#parameters,
-          this.#stylesheetBaseUrl,
-          /*allowAsync*/ false,
-          /*buildPlainText*/ false,
-        );
+        const { content, mimeType } = this.#transform(source, /*buildPlainText*/ false);
         const fragment = document.createDocumentFragment();
         switch (mimeType) {
           case 'text/plain':
@@ -571,6 +878,8 @@
       reset() {
         this.#stylesheetText = null;
         this.#stylesheetBaseUrl = null;
+        this.#freeMemo();
+        this.#memoUnsupported = false;
         this.clearParameters();
       }
     }
@@ -581,6 +890,9 @@
 
     window.XSLTProcessor = XSLTProcessor;
     window.xsltPolyfillReady = xsltPolyfillReady;
+    window.xsltPolyfillResultCacheStats = xsltPolyfillResultCacheStats;
+    window.xsltPolyfillClearResultCache = xsltPolyfillClearResultCache;
+    window.xsltPolyfillIncrementalStats = xsltPolyfillIncrementalStats;
 
     function absoluteUrl(url) {
       return new URL(url, window.location.href).href;
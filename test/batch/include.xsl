@@ -0,0 +1,13 @@
+<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+  <xsl:include href="included.xsl"/>
+  <xsl:output method="html"/>
+  <xsl:template match="/">
+    <html>
+      <body>
+        <p id="include"><xsl:call-template name="included"/></p>
+        <p id="document"><xsl:value-of select="document('data.xml')/data"/></p>
+        <p id="source"><xsl:value-of select="/page/message"/></p>
+      </body>
+    </html>
+  </xsl:template>
+</xsl:stylesheet>
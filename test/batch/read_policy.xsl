@@ -0,0 +1,7 @@
+<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+  <xsl:param name="path"/>
+  <xsl:output method="html"/>
+  <xsl:template match="/">
+    <p id="document">[<xsl:value-of select="document($path)/data"/>]</p>
+  </xsl:template>
+</xsl:stylesheet>
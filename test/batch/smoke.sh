@@ -0,0 +1,53 @@
+#!/bin/sh
+# Smoke test for the native batch transformer (`make batch-check`). Runs a
+# stylesheet that uses <xsl:include> and document() and checks the output,
+# then checks that reads outside --read-root are refused.
+set -e
+
+if [ -z "$1" ]; then
+  echo "Usage: $0 path/to/xslt-batch" >&2
+  exit 1
+fi
+BATCH=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+cd "$(dirname "$0")"
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+timeout 30 "$BATCH" -j 2 -o "$OUT" include.xsl source.xml
+for expected in INCLUDE-PASS DOCUMENT-PASS SOURCE-PASS; do
+  if ! grep -q "$expected" "$OUT/source.html"; then
+    echo "FAIL: $expected not found in output:" >&2
+    cat "$OUT/source.html" >&2
+    exit 1
+  fi
+done
+
+# The include is outside the read root, so the stylesheet must fail to load.
+if timeout 30 "$BATCH" -o "$OUT" --read-root "$OUT" include.xsl source.xml \
+    >/dev/null 2>&1; then
+  echo "FAIL: include outside --read-root was loaded" >&2
+  exit 1
+fi
+
+# document() may read $OUT/secret.xml only when it's under the read root.
+echo '<data>SECRET</data>' > "$OUT/secret.xml"
+if timeout 30 "$BATCH" -o "$OUT/denied" -p path "$OUT/secret.xml" \
+    read_policy.xsl source.xml >/dev/null 2>&1; then
+  echo "FAIL: document() outside --read-root was loaded" >&2
+  exit 1
+fi
+timeout 30 "$BATCH" -o "$OUT/allowed" -p path "$OUT/secret.xml" \
+  --read-root "$OUT" read_policy.xsl source.xml >/dev/null 2>&1
+if ! grep -q SECRET "$OUT/allowed/source.html"; then
+  echo "FAIL: document() under --read-root was refused" >&2
+  exit 1
+fi
+
+# Inputs that map to the same output file must be refused.
+if timeout 30 "$BATCH" -o "$OUT/collide" include.xsl source.xml ./source.xml \
+    >/dev/null 2>&1; then
+  echo "FAIL: inputs with the same output path were accepted" >&2
+  exit 1
+fi
+
+echo "PASS: xslt-batch smoke test"
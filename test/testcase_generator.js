@@ -827,6 +827,123 @@ const testCases = [
         </script>
         </body>`,
   },
+  {
+    name: 'Result cache',
+    html: `
+        <!DOCTYPE html>
+        <body>
+        <script>window.xsltPolyfillResultCacheBytes = 1024 * 1024;</script>
+        {{SCRIPT_INJECTION_LOCATION}}
+        <div id="target" style="color:red">INIT</div>
+        <script>
+        ${UTILITIES}
+        window.onload = () => {
+            const xml = \`<?xml version="1.0" encoding="utf-8"?><root>text</root>\`;
+            const xsl = \`<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+                <xsl:output method="html"/>
+                <xsl:param name="p"/>
+                <xsl:template match="/">
+                    <div id="r"><xsl:value-of select="concat(root, '-', $p)"/></div>
+                </xsl:template>
+            </xsl:stylesheet>\`;
+            const dateXsl = \`<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform"
+                    xmlns:date="http://exslt.org/dates-and-times">
+                <xsl:output method="html"/>
+                <xsl:template match="/">
+                    <div id="r"><xsl:value-of select="string-length(date:date-time()) > 0"/></div>
+                </xsl:template>
+            </xsl:stylesheet>\`;
+            const {xsltProcessor, xmlDoc} = initProcessor(xml, xsl);
+            const run = (processor) => processor.transformToFragment(xmlDoc, document).querySelector('#r').textContent;
+            const results = [];
+            xsltProcessor.setParameter(null, 'p', 'a');
+            results.push(run(xsltProcessor), run(xsltProcessor));
+            xsltProcessor.setParameter(null, 'p', 'b');
+            results.push(run(xsltProcessor));
+            xsltProcessor.setParameter(null, 'p', 'a');
+            results.push(run(xsltProcessor));
+            const dateProcessor = initProcessor(xml, dateXsl).xsltProcessor;
+            results.push(run(dateProcessor), run(dateProcessor));
+            let passed = results.join(',') === 'text-a,text-a,text-b,text-a,true,true';
+            let message = \`results=\${results}\`;
+            if (window.xsltPolyfillResultCacheStats) {
+                const stats = window.xsltPolyfillResultCacheStats();
+                passed = passed && stats.hits === 2 && stats.misses === 2 && stats.bypasses === 2 && stats.entries === 2;
+                message += \`, stats=\${JSON.stringify(stats)}\`;
+            }
+            setResult(passed, message);
+        };
+        </script>
+        </body>`,
+  },
+  {
+    name: 'Performance: Incremental re-transform',
+    html: `
+        <!DOCTYPE html>
+        <body>
+        <script>window.xsltPolyfillIncrementalTransforms = true;</script>
+        {{SCRIPT_INJECTION_LOCATION}}
+        <div id="target" style="color:red">INIT</div>
+        <script>
+        ${UTILITIES}
+        window.onload = () => {
+            const items = 2000;
+            const xml = \`<?xml version="1.0" encoding="utf-8"?>
+                <list>\${Array.from({length: items}, (_, i) => '<item>' + i + '</item>').join('')}</list>\`;
+            const xsl = \`<xsl:stylesheet version="1.0" xmlns:xsl="http://www.w3.org/1999/XSL/Transform">
+                <xsl:output method="html"/>
+                <xsl:param name="title"/>
+                <xsl:param name="unread"/>
+                <xsl:template match="/">
+                    <div id="title"><xsl:value-of select="$title"/></div>
+                    <ul><xsl:apply-templates select="list/item"/></ul>
+                </xsl:template>
+                <xsl:template match="item">
+                    <li class="row{position() mod 2}"><xsl:value-of select="concat('Item ', .)"/></li>
+                </xsl:template>
+            </xsl:stylesheet>\`;
+            const {xsltProcessor, xmlDoc} = initProcessor(xml, xsl);
+            const render = () => {
+                const start = performance.now();
+                const fragment = xsltProcessor.transformToFragment(xmlDoc, document);
+                return {fragment, ms: performance.now() - start};
+            };
+            const repeats = 20;
+            let passed = true;
+            let unreadMs = 0;
+            let readMs = 0;
+            xsltProcessor.setParameter(null, 'title', 'T0');
+            xsltProcessor.setParameter(null, 'unread', 'U0');
+            render();
+            for (let i = 1; i <= repeats; ++i) {
+                // A parameter the stylesheet never reads.
+                xsltProcessor.setParameter(null, 'unread', 'U' + i);
+                const unread = render();
+                unreadMs += unread.ms;
+                passed = passed && unread.fragment.querySelector('#title').textContent === 'T' + (i - 1) &&
+                    unread.fragment.querySelectorAll('li').length === items;
+                // A parameter the stylesheet reads.
+                xsltProcessor.setParameter(null, 'title', 'T' + i);
+                const read = render();
+                readMs += read.ms;
+                passed = passed && read.fragment.querySelector('#title').textContent === 'T' + i &&
+                    read.fragment.querySelectorAll('li').length === items;
+            }
+            let message = '';
+            if (window.xsltPolyfillIncrementalStats) {
+                // An unread change reuses the whole root template; a read
+                // change reruns the root and reuses every item.
+                const reused = window.xsltPolyfillIncrementalStats().reusedInstantiations;
+                passed = passed && reused === repeats * (1 + items);
+                message = \`reusedInstantiations=\${reused}\`;
+            }
+            console.log(\`Incremental re-transform: unread parameter change \${(unreadMs / repeats).toFixed(2)}ms, \` +
+                \`read parameter change \${(readMs / repeats).toFixed(2)}ms (average of \${repeats})\`);
+            setResult(passed, message);
+        };
+        </script>
+        </body>`,
+  },
   {
     name: 'Performance: Split Benchmarks',
     html: `